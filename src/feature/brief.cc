@@ -15,27 +15,25 @@ BRIEF::BRIEF(const Mat32f& img, const vector<SSPoint>& points,
 		const BriefPattern& pattern):
 	img(img), points(points), pattern(pattern) { }
 
-vector<Descriptor> BRIEF::get_descriptor() const {
+FeatureSet BRIEF::get_descriptor() const {
 	TotalTimer tm("brief descriptor");
-	vector<Descriptor> ret;
+	FeatureSet ret(pattern.pattern.size(), 0, FeatureSet::Type::BINARY);
 	const int half = pattern.s / 2;
 	for (auto& p : points) {
 		int x = round(p.real_coor.x * img.width()),
 				y = round(p.real_coor.y * img.height());
-		if (x >= half && x + half < img.width() && y >= half && y + half < img.height()) {
-			auto desp = calc_descriptor(p);
-			ret.emplace_back(move(desp));
-		}
+		if (x >= half && x + half < img.width() && y >= half && y + half < img.height())
+			calc_descriptor(p, ret.add_binary(p.real_coor));
 	}
 	return ret;
 }
 
-Descriptor BRIEF::calc_descriptor(const SSPoint& p) const {
+// desc: zero-filled row of n bits
+void BRIEF::calc_descriptor(const SSPoint& p, uint64_t* desc) const {
 	int x = round(p.real_coor.x * img.width()),
 			y = round(p.real_coor.y * img.height());
 	const int n = pattern.pattern.size();
 	const int half = pattern.s / 2;
-	vector<bool> bits(n, false);
 	auto pixel = [&](int r, int c) {
 		const float* ptr = img.ptr(r, c);
 		return (ptr[0] + ptr[1] + ptr[2]) / 3;
@@ -47,25 +45,16 @@ Descriptor BRIEF::calc_descriptor(const SSPoint& p) const {
 				x1 = x + p1 % pattern.s - half;
 		int y2 = y + p2 / pattern.s - half,
 				x2 = x + p2 % pattern.s - half;
-		bits[i] = pixel(y1, x1) > pixel(y2, x2);
+		if (pixel(y1, x1) > pixel(y2, x2))
+			desc[i / 64] |= 1ULL << (i % 64);
 	}
-	Descriptor ret;
-	ret.coor = p.real_coor;
-	ret.descriptor.resize(n / 32, 0);
-	REP(i, n) if (bits[i]) {
-		int idx = i / 32,
-				offset = i % 32;
-		int* ptr = (int*)&ret.descriptor[idx];
-		*ptr = *ptr | (1 << offset);
-	}
-	return ret;
 }
 
 
 // implement pattern II in BRIEF orignal paper
 BriefPattern BRIEF::gen_brief_pattern(int s, int n) {
 	m_assert(s % 2 == 1);
-	m_assert(n % 32 == 0);
+	m_assert(n % 64 == 0);
 	mt19937 randgen{std::random_device()()};
 	normal_distribution<> d(0.5 * s, 0.2 * s);
 
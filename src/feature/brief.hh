@@ -24,7 +24,7 @@ class BRIEF {
 		BRIEF(const BRIEF&) = delete;
 		BRIEF& operator = (const BRIEF&) = delete;
 
-		std::vector<Descriptor> get_descriptor() const;
+		FeatureSet get_descriptor() const;
 
 		// s: size of patch. n: number of pair
 		static BriefPattern gen_brief_pattern(int s, int n);
@@ -34,7 +34,7 @@ class BRIEF {
 		const std::vector<SSPoint>& points;
 		const BriefPattern& pattern;
 
-		Descriptor calc_descriptor(const SSPoint&) const;
+		void calc_descriptor(const SSPoint&, uint64_t* desc) const;
 };
 
 }
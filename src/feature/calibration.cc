@@ -0,0 +1,174 @@
+//File: calibration.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "calibration.hh"
+#include <algorithm>
+#include <flann/nn/ground_truth.h>
+#include <flann/nn/index_testing.h>
+
+#include "matcher.hh"
+#include "lib/config.hh"
+#include "lib/debugutils.hh"
+#include "lib/timer.hh"
+#include "lib/utils.hh"
+
+using namespace std;
+using namespace config;
+
+namespace {
+const int CHECKS[] = {8, 16, 32, 64, 128, 256, 512, 1024};
+}
+
+namespace pano {
+
+FlannCalibration::FlannCalibration(const vector<FeatureSet>& feats):
+	feats(feats) {
+	m_assert(feats.size() >= 2);
+	if (feats[0].binary())
+		error_exit("Binary descriptors are matched by LSH, which is not calibrated.\n");
+}
+
+vector<FlannCalibration::Result> FlannCalibration::run() const {
+	const float ratio_sqr = sqr(MATCH_REJECT_NEXT_RATIO);
+	if (feats[0].quantized()) {
+		vector<flann::Matrix<unsigned char>> data;
+		for (auto& f : feats)
+			data.emplace_back(byte_matrix(f));
+		return run<L2U8>(data, ratio_sqr);
+	}
+	vector<flann::Matrix<float>> data;
+	for (auto& f : feats)
+		data.emplace_back(descriptor_matrix(f));
+	return run<L2SSE>(data, ratio_sqr);
+}
+
+template <typename Distance, typename T>
+vector<FlannCalibration::Result> FlannCalibration::run(
+		const vector<flann::Matrix<T>>& data, float reject_ratio) const {
+	const int n = data.size();
+	vector<pair<int, int>> pairs;
+	REP(i, n) REPL(j, i + 1, n)
+		pairs.emplace_back(i, j);
+	const int nr_pair = pairs.size();
+	Distance dist;
+
+	// the exact two nearest neighbours, and the index of the ratio-test match or -1
+	vector<vector<size_t>> gt_buf(nr_pair);
+	vector<vector<int>> truth(nr_pair);
+	{
+		GuardedTimer tm("Compute ground truth");
+#pragma omp parallel for schedule(dynamic)
+		REP(pi, nr_pair) {
+			auto& query = data[pairs[pi].first];
+			auto& dataset = data[pairs[pi].second];
+			gt_buf[pi].resize(query.rows * 2);
+			flann::Matrix<size_t> gt(gt_buf[pi].data(), query.rows, 2);
+			flann::compute_ground_truth<Distance>(dataset, query, gt, 0, dist);
+			truth[pi].resize(query.rows, -1);
+			REP(q, (int)query.rows) {
+				float d1 = dist(dataset[gt[q][0]], query[q], query.cols),
+							d2 = dist(dataset[gt[q][1]], query[q], query.cols);
+				if (d1 <= reject_ratio * d2)
+					truth[pi][q] = gt[q][0];
+			}
+		}
+	}
+	int nr_truth = 0;
+	for (auto& t : truth)
+		nr_truth += count_if(t.begin(), t.end(), [](int x) { return x >= 0; });
+	print_debug("%d exact matches in %d pairs\n", nr_truth, nr_pair);
+
+	vector<Result> ret;
+	// evaluate the indices built with p, with each number of checks
+	auto evaluate = [&](FlannParams p, const vector<int>& checks) {
+		vector<flann::Index<Distance>> indices;
+		indices.reserve(n);
+		Timer timer;
+		REP(i, n) {
+			indices.emplace_back(data[i], p.index_params(), dist);
+			indices.back().buildIndex();
+		}
+		double build_time = timer.duration() / n;
+
+		for (int c : checks) {
+			p.checks = c;
+			auto params = p.search_params();
+			Result res{p, 0, 0, build_time, 0};
+			int nr_found = 0;
+			REP(pi, nr_pair) {
+				auto& query = data[pairs[pi].first];
+				auto& dataset = data[pairs[pi].second];
+				auto& index = indices[pairs[pi].second];
+				const int nq = query.rows;
+
+				// query time and precision of the two nearest neighbours, by index_testing.h
+				flann::Matrix<size_t> gt(gt_buf[pi].data(), nq, 2);
+				float precision;
+				res.query_time += flann::test_index_checks(
+						index, dataset, query, gt, params.checks, precision, dist, 2);
+				res.precision += precision / nr_pair;
+
+				vector<int> indices_buf(nq * 2, -1);
+				vector<typename Distance::ResultType> dists_buf(nq * 2);
+				flann::Matrix<int> knn(indices_buf.data(), nq, 2);
+				flann::Matrix<typename Distance::ResultType> dists(dists_buf.data(), nq, 2);
+				index.knnSearch(query, knn, dists, 2, params);
+				REP(q, nq)
+					if (truth[pi][q] >= 0 && knn[q][0] == truth[pi][q] && knn[q][1] >= 0 &&
+							dists[q][0] <= reject_ratio * dists[q][1])
+						nr_found ++;
+			}
+			res.query_time /= nr_pair;
+			res.recall = nr_truth ? (float)nr_found / nr_truth : 1;
+			print_debug("index=%d checks=%d: recall %.4f, 2-nn precision %.4f, "
+					"build %.4lfs per image, query %.4lfs per pair\n",
+					p.algo, p.checks, res.recall, res.precision, res.build_time, res.query_time);
+			ret.emplace_back(res);
+		}
+	};
+	REP(algo, 3) {
+		FlannParams p;
+		p.algo = algo;
+		evaluate(p, vector<int>(begin(CHECKS), end(CHECKS)));
+	}
+
+	// autotuning is too slow to run on every image, so it's done on the first one,
+	// and the parameters it chose are evaluated as the others
+	FlannParams tuned;
+	{
+		GuardedTimer tm("FLANN autotuning");
+		flann::Index<Distance> index(data[0], flann::AutotunedIndexParams(FLANN_TARGET_RECALL), dist);
+		index.buildIndex();
+		if (! tuned.from_autotuned(index.getParameters())) {
+			print_debug("FLANN autotuning chose linear search\n");
+			return ret;
+		}
+	}
+	print_debug("FLANN autotuning chose:\n%s", tuned.to_config().c_str());
+	evaluate(tuned, {tuned.checks});
+	return ret;
+}
+
+FlannCalibration::Result FlannCalibration::choose(
+		const vector<Result>& results, float target) const {
+	m_assert(results.size());
+	const int n = feats.size();
+	const Result* best = nullptr;
+	for (auto& r : results)
+		if (r.recall >= target && (! best || r.pair_time(n) < best->pair_time(n)))
+			best = &r;
+	if (best)
+		return *best;
+	return *max_element(results.begin(), results.end(),
+			[](const Result& a, const Result& b) { return a.recall < b.recall; });
+}
+
+double FlannCalibration::brute_force_time() const {
+	const int n = feats.size();
+	Timer timer;
+	REP(i, n) REPL(j, i + 1, n)
+		FeatureMatcher(feats[i], feats[j]).match();
+	return timer.duration() / (n * (n - 1) / 2);
+}
+
+}
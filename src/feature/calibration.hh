@@ -0,0 +1,52 @@
+//File: calibration.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <vector>
+#include <flann/flann.hpp>
+#include "feature.hh"
+#include "matcher.hh"
+
+namespace pano {
+
+// Measure the FLANN settings of matching float or quantized descriptors on a sample of images,
+// to trade the accuracy of the approximate matches for speed.
+// Each pair i < j is matched by querying features of i in the index of j, as in PairWiseMatcher,
+// and compared against the exact ratio-test matches from the ground truth nearest neighbours.
+class FlannCalibration {
+	public:
+		struct Result {
+			FlannParams params;
+			float recall;				// of the exact ratio-test matches
+			float precision;		// of the two nearest neighbours
+			double build_time;	// per image, in seconds
+			double query_time;	// per pair, in seconds
+
+			// time per pair, when every pair of the sample is matched
+			double pair_time(int nr_img) const
+			{ return query_time + build_time * 2 / (nr_img - 1); }
+		};
+
+		explicit FlannCalibration(const std::vector<FeatureSet>& feats);
+
+		FlannCalibration(const FlannCalibration&) = delete;
+		FlannCalibration& operator = (const FlannCalibration&) = delete;
+
+		// results of all index types with a range of checks,
+		// and of the parameters chosen by FLANN autotuning on the first image
+		std::vector<Result> run() const;
+
+		// the fastest result that reaches the recall target, or the most accurate one
+		Result choose(const std::vector<Result>& results, float target) const;
+
+		// time per pair of the exact brute-force matcher
+		double brute_force_time() const;
+
+	protected:
+		const std::vector<FeatureSet>& feats;
+
+		template <typename Distance, typename T>
+		std::vector<Result> run(const std::vector<flann::Matrix<T>>& data, float reject_ratio) const;
+};
+
+}
@@ -4,61 +4,39 @@
 
 #include "dist.hh"
 #include "lib/debugutils.hh"
+#include "lib/simd.hh"
 #include "lib/utils.hh"
 #include "lib/timer.hh"
 
+#include <cstring>
 #include <limits>
 
-namespace pano {
-
-#if defined(__SSE3__) || defined(__AVX__) || (_M_IX86_FP >= 2)
 #ifdef _MSC_VER
-#include <nmmintrin.h>
+#if defined(__AVX__) || (_M_IX86_FP >= 2)
+#  include <nmmintrin.h>
+#  define __builtin_popcount _mm_popcnt_u32
+#  define __builtin_popcountll _mm_popcnt_u64
 #else
-#include <x86intrin.h>
+#  include <intrin.h>
+#  define __builtin_popcount __popcnt
+#  define __builtin_popcountll __popcnt64
+#endif
 #endif
 
-// %35 faster
-float euclidean_sqr(
-		const float* x, const float* y,
-		size_t n, float now_thres) {
-	/*
-	 *static long long cnt = 0;
-	 *cnt ++; if (cnt % 10000000 == 0) PP(cnt);
-	 */
-	float ans = 0;
-	__m128 vsum = _mm_set1_ps(0.0f);
-	m_assert(n % 4 == 0);
-	for (; n > 0; n -= 4) {
-		const __m128 a = _mm_loadu_ps(x);
-		const __m128 b = _mm_loadu_ps(y);
-		const __m128 diff = _mm_sub_ps(a, b);
-		const __m128 sqr = _mm_mul_ps(diff, diff);
-		vsum = _mm_add_ps(vsum, sqr);
-
-		// check result temporarily. slightly faster
-		if (n % 32 == 0) {
-			__m128 rst = _mm_hadd_ps(vsum, vsum);
-			rst = _mm_hadd_ps(rst, rst);
-			_mm_store_ss(&ans, rst);
-			if (ans > now_thres)
-				return std::numeric_limits<float>::max();
-		}
+namespace {
 
-		x += 4;
-		y += 4;
-		_mm_prefetch((char*)x, _MM_HINT_T0);
-		_mm_prefetch((char*)y, _MM_HINT_T0);
-	}
-	__m128 rst = _mm_hadd_ps(vsum, vsum);
-	rst = _mm_hadd_ps(rst, rst);
-	_mm_store_ss(&ans, rst);
-	return ans;
-}
+using namespace pano;
 
-#else
+// the partial sum is compared with the threshold once every EARLY_STOP_LEN floats
+const int EARLY_STOP_LEN = 64;
 
-float euclidean_sqr(
+typedef float (*EuclideanFunc)(const float*, const float*, size_t, float);
+typedef int (*EuclideanU8Func)(const uint8_t*, const uint8_t*, size_t);
+typedef int (*HammingFunc)(const uint64_t*, const uint64_t*, int);
+typedef void (*DotPackedFunc)(const float*, size_t, int,
+		const float*, int, int, float*, size_t);
+
+float euclidean_scalar(
 		const float* x, const float* y,
 		size_t size, float now_thres) {
 	m_assert(size % 4 == 0);
@@ -78,26 +56,403 @@ float euclidean_sqr(
 	return ans;
 }
 
+int euclidean_u8_scalar(
+		const uint8_t* x, const uint8_t* y, size_t n) {
+	int ans = 0;
+	REP(i, n) {
+		int diff = (int)x[i] - (int)y[i];
+		ans += diff * diff;
+	}
+	return ans;
+}
+
+int hamming_scalar(const uint64_t* x, const uint64_t* y, int n) {
+	int sum = 0;
+	REP(i, n)
+		sum += __builtin_popcountll(x[i] ^ y[i]);
+	return sum;
+}
+
+void dot_packed_scalar(const float* a, size_t lda, int m,
+		const float* bp, int n, int d, float* c, size_t ldc) {
+	const int nr_panel = (n + DOT_PANEL - 1) / DOT_PANEL;
+	REP(p, nr_panel) {
+		const float* panel = bp + (size_t)p * d * DOT_PANEL;
+		REP(i, m) {
+			const float* ai = a + i * lda;
+			float acc[DOT_PANEL] = {0};
+			REP(k, d) {
+				const float x = ai[k], *pk = panel + k * DOT_PANEL;
+				REP(j, DOT_PANEL)
+					acc[j] += x * pk[j];
+			}
+			memcpy(c + i * ldc + p * DOT_PANEL, acc, sizeof(acc));
+		}
+	}
+}
+
+#ifdef PANO_SIMD_DISPATCH
+
+PANO_TARGET("sse2")
+inline float hsum_sse2(__m128 v) {
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+PANO_TARGET("sse2")
+float euclidean_sse2(
+		const float* x, const float* y,
+		size_t n, float now_thres) {
+	m_assert(n % 4 == 0);
+	__m128 vsum0 = _mm_setzero_ps(), vsum1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)),
+					d1 = _mm_sub_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4));
+		vsum0 = _mm_add_ps(vsum0, _mm_mul_ps(d0, d0));
+		vsum1 = _mm_add_ps(vsum1, _mm_mul_ps(d1, d1));
+		if ((i + 8) % EARLY_STOP_LEN == 0 &&
+				hsum_sse2(_mm_add_ps(vsum0, vsum1)) > now_thres)
+			return std::numeric_limits<float>::max();
+	}
+	for (; i < n; i += 4) {
+		const __m128 d = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+		vsum0 = _mm_add_ps(vsum0, _mm_mul_ps(d, d));
+	}
+	return hsum_sse2(_mm_add_ps(vsum0, vsum1));
+}
+
+PANO_TARGET("avx2,fma")
+inline float hsum_avx2(__m256 v) {
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+PANO_TARGET("avx2,fma")
+float euclidean_avx2(
+		const float* x, const float* y,
+		size_t n, float now_thres) {
+	m_assert(n % 4 == 0);
+	__m256 vsum0 = _mm256_setzero_ps(), vsum1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)),
+					d1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8));
+		vsum0 = _mm256_fmadd_ps(d0, d0, vsum0);
+		vsum1 = _mm256_fmadd_ps(d1, d1, vsum1);
+		if ((i + 16) % EARLY_STOP_LEN == 0 &&
+				hsum_avx2(_mm256_add_ps(vsum0, vsum1)) > now_thres)
+			return std::numeric_limits<float>::max();
+	}
+	float ans = hsum_avx2(_mm256_add_ps(vsum0, vsum1));
+	for (; i < n; ++i)
+		ans += sqr(x[i] - y[i]);
+	return ans;
+}
+
+// add the four 128-bit lanes. the plain extracts, casts and _mm512_reduce_add_* of GCC 12
+// start from an undefined register and warn about it, so extract with a mask into zero
+PANO_TARGET("avx512f,avx512bw")
+inline float hsum_avx512(__m512 v) {
+	const __m128 zero = _mm_setzero_ps();
+	__m128 s = _mm_add_ps(
+			_mm_add_ps(_mm512_mask_extractf32x4_ps(zero, 0xf, v, 0), _mm512_mask_extractf32x4_ps(zero, 0xf, v, 1)),
+			_mm_add_ps(_mm512_mask_extractf32x4_ps(zero, 0xf, v, 2), _mm512_mask_extractf32x4_ps(zero, 0xf, v, 3)));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+	return _mm_cvtss_f32(s);
+}
+
+PANO_TARGET("avx512f,avx512bw")
+inline int hsum_epi32_avx512(__m512i v) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i s = _mm_add_epi32(
+			_mm_add_epi32(_mm512_mask_extracti32x4_epi32(zero, 0xf, v, 0), _mm512_mask_extracti32x4_epi32(zero, 0xf, v, 1)),
+			_mm_add_epi32(_mm512_mask_extracti32x4_epi32(zero, 0xf, v, 2), _mm512_mask_extracti32x4_epi32(zero, 0xf, v, 3)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+
+PANO_TARGET("avx512f,avx512bw")
+float euclidean_avx512(
+		const float* x, const float* y,
+		size_t n, float now_thres) {
+	m_assert(n % 4 == 0);
+	__m512 vsum0 = _mm512_setzero_ps(), vsum1 = _mm512_setzero_ps();
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		const __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)),
+					d1 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16), _mm512_loadu_ps(y + i + 16));
+		vsum0 = _mm512_fmadd_ps(d0, d0, vsum0);
+		vsum1 = _mm512_fmadd_ps(d1, d1, vsum1);
+		if ((i + 32) % EARLY_STOP_LEN == 0 &&
+				hsum_avx512(_mm512_add_ps(vsum0, vsum1)) > now_thres)
+			return std::numeric_limits<float>::max();
+	}
+	if (i < n) {
+		// mask the tail, at most 28 floats
+		const __mmask16 m0 = (__mmask16)((1u << std::min<size_t>(n - i, 16)) - 1),
+					m1 = (__mmask16)((1u << (n - i > 16 ? n - i - 16 : 0)) - 1);
+		const __m512 d0 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m0, x + i), _mm512_maskz_loadu_ps(m0, y + i)),
+					d1 = _mm512_sub_ps(_mm512_maskz_loadu_ps(m1, x + i + 16), _mm512_maskz_loadu_ps(m1, y + i + 16));
+		vsum0 = _mm512_fmadd_ps(d0, d0, vsum0);
+		vsum1 = _mm512_fmadd_ps(d1, d1, vsum1);
+	}
+	return hsum_avx512(_mm512_add_ps(vsum0, vsum1));
+}
+
+// squared differences of bytes are summed by madd on 16-bit lanes
+PANO_TARGET("sse2")
+int euclidean_u8_sse2(
+		const uint8_t* x, const uint8_t* y, size_t n) {
+	m_assert(n % 16 == 0);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vsum = zero;
+	for (size_t i = 0; i < n; i += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i*)(x + i));
+		const __m128i b = _mm_loadu_si128((const __m128i*)(y + i));
+		const __m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		const __m128i lo = _mm_unpacklo_epi8(diff, zero),
+					hi = _mm_unpackhi_epi8(diff, zero);
+		vsum = _mm_add_epi32(vsum, _mm_madd_epi16(lo, lo));
+		vsum = _mm_add_epi32(vsum, _mm_madd_epi16(hi, hi));
+	}
+	vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(1, 0, 3, 2)));
+	vsum = _mm_add_epi32(vsum, _mm_shuffle_epi32(vsum, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(vsum);
+}
+
+PANO_TARGET("avx2,fma")
+int euclidean_u8_avx2(
+		const uint8_t* x, const uint8_t* y, size_t n) {
+	m_assert(n % 32 == 0);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i vsum = zero;
+	for (size_t i = 0; i < n; i += 32) {
+		const __m256i a = _mm256_loadu_si256((const __m256i*)(x + i));
+		const __m256i b = _mm256_loadu_si256((const __m256i*)(y + i));
+		const __m256i diff = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+		const __m256i lo = _mm256_unpacklo_epi8(diff, zero),
+					hi = _mm256_unpackhi_epi8(diff, zero);
+		vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(lo, lo));
+		vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(hi, hi));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(vsum), _mm256_extracti128_si256(vsum, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(s);
+}
+
+PANO_TARGET("avx512f,avx512bw")
+int euclidean_u8_avx512(
+		const uint8_t* x, const uint8_t* y, size_t n) {
+	m_assert(n % 32 == 0);
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i vsum = zero;
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		const __m512i a = _mm512_loadu_si512(x + i);
+		const __m512i b = _mm512_loadu_si512(y + i);
+		const __m512i diff = _mm512_or_si512(_mm512_subs_epu8(a, b), _mm512_subs_epu8(b, a));
+		const __m512i lo = _mm512_unpacklo_epi8(diff, zero),
+					hi = _mm512_unpackhi_epi8(diff, zero);
+		vsum = _mm512_add_epi32(vsum, _mm512_madd_epi16(lo, lo));
+		vsum = _mm512_add_epi32(vsum, _mm512_madd_epi16(hi, hi));
+	}
+	if (i < n) {
+		// one row of 32 bytes left, widen it directly
+		const __m512i a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(x + i)));
+		const __m512i b = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(y + i)));
+		const __m512i diff = _mm512_sub_epi16(a, b);
+		vsum = _mm512_add_epi32(vsum, _mm512_madd_epi16(diff, diff));
+	}
+	return hsum_epi32_avx512(vsum);
+}
+
+// count bits of each nibble by a table lookup with pshufb, then sum the bytes by sad
+PANO_TARGET("avx2,fma,popcnt")
+int hamming_avx2(const uint64_t* x, const uint64_t* y, int n) {
+	const __m256i table = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i vsum = _mm256_setzero_si256();
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m256i v = _mm256_xor_si256(
+				_mm256_loadu_si256((const __m256i*)(x + i)),
+				_mm256_loadu_si256((const __m256i*)(y + i)));
+		const __m256i cnt = _mm256_add_epi8(
+				_mm256_shuffle_epi8(table, _mm256_and_si256(v, low_mask)),
+				_mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask)));
+		vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(vsum), _mm256_extracti128_si256(vsum, 1));
+	s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+	int sum = _mm_cvtsi128_si32(s);
+	// every CPU with AVX2 has popcnt
+	for (; i < n; ++i)
+		sum += __builtin_popcountll(x[i] ^ y[i]);
+	return sum;
+}
+
+// 6 rows of a times a panel, in 12 of the 16 ymm registers.
+// each step broadcasts one element of every row, against 16 packed elements of the panel.
+// accumulators are named variables, as gcc spills an array of them to the stack
+PANO_TARGET("avx2,fma")
+inline void dot_panel6_avx2(const float* a, size_t lda,
+		const float* panel, int d, float* c, size_t ldc) {
+	__m256 c00 = _mm256_setzero_ps(), c01 = c00, c10 = c00, c11 = c00,
+				 c20 = c00, c21 = c00, c30 = c00, c31 = c00,
+				 c40 = c00, c41 = c00, c50 = c00, c51 = c00;
+	const float *a0 = a, *a1 = a + lda, *a2 = a1 + lda,
+				*a3 = a2 + lda, *a4 = a3 + lda, *a5 = a4 + lda;
+	REP(k, d) {
+		const __m256 b0 = _mm256_loadu_ps(panel + k * DOT_PANEL),
+					b1 = _mm256_loadu_ps(panel + k * DOT_PANEL + 8);
+		__m256 x = _mm256_broadcast_ss(a0 + k);
+		c00 = _mm256_fmadd_ps(x, b0, c00); c01 = _mm256_fmadd_ps(x, b1, c01);
+		x = _mm256_broadcast_ss(a1 + k);
+		c10 = _mm256_fmadd_ps(x, b0, c10); c11 = _mm256_fmadd_ps(x, b1, c11);
+		x = _mm256_broadcast_ss(a2 + k);
+		c20 = _mm256_fmadd_ps(x, b0, c20); c21 = _mm256_fmadd_ps(x, b1, c21);
+		x = _mm256_broadcast_ss(a3 + k);
+		c30 = _mm256_fmadd_ps(x, b0, c30); c31 = _mm256_fmadd_ps(x, b1, c31);
+		x = _mm256_broadcast_ss(a4 + k);
+		c40 = _mm256_fmadd_ps(x, b0, c40); c41 = _mm256_fmadd_ps(x, b1, c41);
+		x = _mm256_broadcast_ss(a5 + k);
+		c50 = _mm256_fmadd_ps(x, b0, c50); c51 = _mm256_fmadd_ps(x, b1, c51);
+	}
+	_mm256_storeu_ps(c, c00); _mm256_storeu_ps(c + 8, c01); c += ldc;
+	_mm256_storeu_ps(c, c10); _mm256_storeu_ps(c + 8, c11); c += ldc;
+	_mm256_storeu_ps(c, c20); _mm256_storeu_ps(c + 8, c21); c += ldc;
+	_mm256_storeu_ps(c, c30); _mm256_storeu_ps(c + 8, c31); c += ldc;
+	_mm256_storeu_ps(c, c40); _mm256_storeu_ps(c + 8, c41); c += ldc;
+	_mm256_storeu_ps(c, c50); _mm256_storeu_ps(c + 8, c51);
+}
+
+// one row of a times a panel, for the remaining rows
+PANO_TARGET("avx2,fma")
+inline void dot_panel1_avx2(const float* a,
+		const float* panel, int d, float* c) {
+	__m256 c0 = _mm256_setzero_ps(), c1 = c0;
+	REP(k, d) {
+		const __m256 x = _mm256_broadcast_ss(a + k);
+		c0 = _mm256_fmadd_ps(x, _mm256_loadu_ps(panel + k * DOT_PANEL), c0);
+		c1 = _mm256_fmadd_ps(x, _mm256_loadu_ps(panel + k * DOT_PANEL + 8), c1);
+	}
+	_mm256_storeu_ps(c, c0);
+	_mm256_storeu_ps(c + 8, c1);
+}
+
+PANO_TARGET("avx2,fma")
+void dot_packed_avx2(const float* a, size_t lda, int m,
+		const float* bp, int n, int d, float* c, size_t ldc) {
+	static_assert(DOT_PANEL == 16, "");
+	const int nr_panel = (n + DOT_PANEL - 1) / DOT_PANEL;
+	REP(p, nr_panel) {
+		const float* panel = bp + (size_t)p * d * DOT_PANEL;
+		float* cp = c + p * DOT_PANEL;
+		int i = 0;
+		for (; i + 6 <= m; i += 6)
+			dot_panel6_avx2(a + i * lda, lda, panel, d, cp + i * ldc, ldc);
+		for (; i < m; i ++)
+			dot_panel1_avx2(a + i * lda, panel, d, cp + i * ldc);
+	}
+}
+
 #endif
 
-#ifdef _MSC_VER
-#if defined(__AVX__) || (_M_IX86_FP >= 2)
-#  include <nmmintrin.h>
-#  define __builtin_popcount _mm_popcnt_u32
-#else
-#  include <intrin.h>
-#  define __builtin_popcount __popcnt
+EuclideanFunc select_euclidean() {
+#ifdef PANO_SIMD_DISPATCH
+	switch (simd_level()) {
+		case SIMDLevel::AVX512:
+			return euclidean_avx512;
+		case SIMDLevel::AVX2:
+			return euclidean_avx2;
+		case SIMDLevel::SSE2:
+			return euclidean_sse2;
+		default:
+			break;
+	}
 #endif
+	return euclidean_scalar;
+}
+
+EuclideanU8Func select_euclidean_u8() {
+#ifdef PANO_SIMD_DISPATCH
+	switch (simd_level()) {
+		case SIMDLevel::AVX512:
+			return euclidean_u8_avx512;
+		case SIMDLevel::AVX2:
+			return euclidean_u8_avx2;
+		case SIMDLevel::SSE2:
+			return euclidean_u8_sse2;
+		default:
+			break;
+	}
 #endif
+	return euclidean_u8_scalar;
+}
 
-int hamming(const float* x, const float* y, int n) {
-	int sum = 0;
-	REP(i, n) {
-		unsigned int* p1 = (unsigned int*)&x[i];
-		unsigned int* p2 = (unsigned int*)&y[i];
-		sum += __builtin_popcount((*p1) ^ *(p2));
+HammingFunc select_hamming() {
+#ifdef PANO_SIMD_DISPATCH
+	if (simd_level() >= SIMDLevel::AVX2)
+		return hamming_avx2;
+#endif
+	return hamming_scalar;
+}
+
+DotPackedFunc select_dot_packed() {
+#ifdef PANO_SIMD_DISPATCH
+	if (simd_level() >= SIMDLevel::AVX2)
+		return dot_packed_avx2;
+#endif
+	return dot_packed_scalar;
+}
+
+}
+
+namespace pano {
+
+float euclidean_sqr(
+		const float* x, const float* y,
+		size_t n, float now_thres) {
+	// selected on first use, so that it is also ready for other static initializers
+	static const EuclideanFunc impl = select_euclidean();
+	return impl(x, y, n, now_thres);
+}
+
+int euclidean_sqr(
+		const uint8_t* x, const uint8_t* y, size_t n) {
+	static const EuclideanU8Func impl = select_euclidean_u8();
+	return impl(x, y, n);
+}
+
+int hamming(const uint64_t* x, const uint64_t* y, int n) {
+	static const HammingFunc impl = select_hamming();
+	return impl(x, y, n);
+}
+
+void pack_dot_panels(const float* b, size_t ldb, int n, int d, float* out) {
+	const int nr_panel = (n + DOT_PANEL - 1) / DOT_PANEL;
+	memset(out, 0, sizeof(float) * d * nr_panel * DOT_PANEL);
+	REP(j, n) {
+		float* panel = out + (size_t)(j / DOT_PANEL) * d * DOT_PANEL + j % DOT_PANEL;
+		const float* bj = b + j * ldb;
+		REP(k, d)
+			panel[k * DOT_PANEL] = bj[k];
 	}
-	return sum;
+}
+
+void dot_packed(const float* a, size_t lda, int m,
+		const float* bp, int n, int d, float* c, size_t ldc) {
+	static const DotPackedFunc impl = select_dot_packed();
+	impl(a, lda, m, bp, n, d, c, ldc);
 }
 
 }
@@ -4,6 +4,8 @@
 
 #pragma once
 #include <limits>
+#include <cstdint>
+#include <type_traits>
 #include "lib/debugutils.hh"
 
 namespace pano {
@@ -12,7 +14,28 @@ float euclidean_sqr(
 		const float* x, const float* y,
 		size_t n, float now_thres);
 
-int hamming(const float* x, const float* y, int n);
+// for quantized descriptors
+int euclidean_sqr(
+		const uint8_t* x, const uint8_t* y, size_t n);
+
+// n: number of 64-bit words
+int hamming(const uint64_t* x, const uint64_t* y, int n);
+
+// Dot products of many pairs of vectors, as a matrix product,
+// for brute-force matching by |a|^2 + |b|^2 - 2 a.b
+
+// number of vectors in a panel of the packed layout
+const int DOT_PANEL = 16;
+
+// pack n vectors of dim d (spaced by ldb floats) into panels of DOT_PANEL vectors.
+// a panel is stored transposed, as d x DOT_PANEL, and the last one is padded with zero.
+// out: d * round_up(n, DOT_PANEL) floats
+void pack_dot_panels(const float* b, size_t ldb, int n, int d, float* out);
+
+// c[i * ldc + j] = a_i . b_j, for i < m and j < round_up(n, DOT_PANEL).
+// a: m vectors of dim d, spaced by lda floats. bp: n vectors packed by pack_dot_panels
+void dot_packed(const float* a, size_t lda, int m,
+		const float* bp, int n, int d, float* c, size_t ldc);
 
 // a L2 implementation compatible with FLANN to use
 // work for float array of size 4k
@@ -35,4 +58,58 @@ struct L2SSE {
     }
 };
 
+// L2 on quantized descriptors, compatible with FLANN
+// work for uint8 array of size 32k
+struct L2U8 {
+    typedef bool is_kdtree_distance;
+    typedef unsigned char ElementType;
+    typedef float ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    inline float operator()(
+				Iterator1 a, Iterator2 b,
+				size_t size, ResultType /*worst_dist*/ = -1) const {
+				typedef typename std::decay<decltype(*a)>::type T1;
+				typedef typename std::decay<decltype(*b)>::type T2;
+				return dist(a, b, size, std::integral_constant<bool,
+						std::is_same<T1, unsigned char>::value && std::is_same<T2, unsigned char>::value>());
+    }
+
+    template <typename U, typename V>
+    inline ResultType accum_dist(const U& a, const V& b, int) const {
+        return ((float)a-b)*((float)a-b);
+    }
+
+  private:
+    template <typename Iterator1, typename Iterator2>
+    inline float dist(Iterator1 a, Iterator2 b, size_t size, std::true_type) const {
+				return pano::euclidean_sqr(&*a, &*b, size);
+    }
+
+    // FLANN may also compare against float vectors, e.g. the tree node means
+    template <typename Iterator1, typename Iterator2>
+    inline float dist(Iterator1 a, Iterator2 b, size_t size, std::false_type) const {
+				float ans = 0;
+				for (size_t i = 0; i < size; ++i)
+					ans += accum_dist(a[i], b[i], i);
+				return ans;
+    }
+};
+
+// hamming distance on packed bits, compatible with FLANN LshIndex
+// work for uint8 array of size 8k
+struct HammingU64 {
+    typedef unsigned char ElementType;
+    typedef int ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    inline ResultType operator()(
+				Iterator1 a, Iterator2 b,
+				size_t size, ResultType /*worst_dist*/ = -1) const {
+				return pano::hamming(
+						reinterpret_cast<const uint64_t*>(&*a),
+						reinterpret_cast<const uint64_t*>(&*b), size / sizeof(uint64_t));
+    }
+};
+
 }
@@ -0,0 +1,133 @@
+//File: extrema_scan.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "extrema_scan.hh"
+
+#include <cmath>
+#include "lib/simd.hh"
+#include "lib/utils.hh"
+using namespace std;
+
+namespace {
+
+using namespace pano;
+
+typedef void (*ScanFunc)(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out);
+
+inline void scan_range(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out) {
+	const float* cur = rows[1][1];
+	for (int c = begin; c < end; ++c) {
+		float v = cur[c];
+		if (fabs(v) <= thres) continue;
+		bool is_max = true, is_min = true;
+		for (int k = 0; k < 9 && (is_max || is_min); ++k) {
+			const float* p = rows[k / 3][k % 3] + c - 1;
+			REP(i, 3) {
+				is_max &= v >= p[i];
+				is_min &= v <= p[i];
+			}
+		}
+		if (is_max || is_min)
+			out.push_back(c);
+	}
+}
+
+void scan_scalar(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out) {
+	scan_range(rows, begin, end, thres, out);
+}
+
+#ifdef PANO_SIMD_DISPATCH
+
+inline void emit_mask(int mask, int c, vector<int>& out) {
+	while (mask) {
+		out.push_back(c + __builtin_ctz(mask));
+		mask &= mask - 1;
+	}
+}
+
+PANO_TARGET("sse2")
+void scan_sse2(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out) {
+	const __m128 sign = _mm_set1_ps(-0.f), th = _mm_set1_ps(thres);
+	const float* cur = rows[1][1];
+	int c = begin;
+	for (; c + 4 <= end; c += 4) {
+		__m128 v = _mm_loadu_ps(cur + c);
+		int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_andnot_ps(sign, v), th));
+		if (! mask) continue;
+		__m128 mx = v, mn = v;
+		REP(i, 3) REP(j, 3) {
+			const float* p = rows[i][j] + c;
+			__m128 a = _mm_loadu_ps(p - 1), b = _mm_loadu_ps(p), d = _mm_loadu_ps(p + 1);
+			mx = _mm_max_ps(mx, _mm_max_ps(a, _mm_max_ps(b, d)));
+			mn = _mm_min_ps(mn, _mm_min_ps(a, _mm_min_ps(b, d)));
+		}
+		// v is included in mx and mn, so >= / <= means equal to the extreme value
+		mask &= _mm_movemask_ps(_mm_or_ps(_mm_cmpge_ps(v, mx), _mm_cmple_ps(v, mn)));
+		emit_mask(mask, c, out);
+	}
+	scan_range(rows, c, end, thres, out);
+}
+
+PANO_TARGET("avx2")
+void scan_avx2(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out) {
+	const __m256 sign = _mm256_set1_ps(-0.f), th = _mm256_set1_ps(thres);
+	const float* cur = rows[1][1];
+	int c = begin;
+	for (; c + 8 <= end; c += 8) {
+		__m256 v = _mm256_loadu_ps(cur + c);
+		int mask = _mm256_movemask_ps(
+				_mm256_cmp_ps(_mm256_andnot_ps(sign, v), th, _CMP_GT_OQ));
+		if (! mask) continue;
+		__m256 mx = v, mn = v;
+		REP(i, 3) REP(j, 3) {
+			const float* p = rows[i][j] + c;
+			__m256 a = _mm256_loadu_ps(p - 1), b = _mm256_loadu_ps(p), d = _mm256_loadu_ps(p + 1);
+			mx = _mm256_max_ps(mx, _mm256_max_ps(a, _mm256_max_ps(b, d)));
+			mn = _mm256_min_ps(mn, _mm256_min_ps(a, _mm256_min_ps(b, d)));
+		}
+		mask &= _mm256_movemask_ps(_mm256_or_ps(
+					_mm256_cmp_ps(v, mx, _CMP_GE_OQ), _mm256_cmp_ps(v, mn, _CMP_LE_OQ)));
+		emit_mask(mask, c, out);
+	}
+	scan_range(rows, c, end, thres, out);
+}
+
+#endif
+
+ScanFunc select_scan() {
+#ifdef PANO_SIMD_DISPATCH
+	switch (simd_level()) {
+		case SIMDLevel::AVX512:
+		case SIMDLevel::AVX2:
+			return scan_avx2;
+		case SIMDLevel::SSE2:
+			return scan_sse2;
+		default:
+			break;
+	}
+#endif
+	return scan_scalar;
+}
+
+}	// namespace
+
+namespace pano {
+
+void scan_extrema_row(
+		const float* const rows[3][3], int begin, int end,
+		float thres, vector<int>& out) {
+	static const ScanFunc scan = select_scan();
+	scan(rows, begin, end, thres, out);
+}
+
+}
@@ -0,0 +1,19 @@
+//File: extrema_scan.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <vector>
+
+namespace pano {
+
+// Find local extrema in one row of a DoG layer.
+// rows[i][j] is row (r - 1 + j) of DoG layer (l - 1 + i), so rows[1][1] is the row being scanned.
+// A pixel is an extremum if it is >= (or <=) all of its 26 neighbours.
+// Pixels with |value| <= thres are rejected before the comparison.
+// Columns in [begin, end) are scanned, requiring begin >= 1 and end <= width - 1.
+// Columns of the extrema are appended to out, in increasing order.
+void scan_extrema_row(
+		const float* const rows[3][3], int begin, int end,
+		float thres, std::vector<int>& out);
+
+}
@@ -8,8 +8,13 @@
 #include "sift.hh"
 #include "dog.hh"
 #include "brief.hh"
+#include "orb.hh"
 #include "mysift.h"
+#include "lib/bufferpool.hh"
 #include "lib/imgproc.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 
 using namespace std;
 using namespace config;
@@ -17,22 +22,119 @@ using namespace config;
 
 namespace pano {
 
+FeatureSet::FeatureSet(int dim, int capacity, Type type):
+	type_(type), D(dim), row_stride(padded_bytes(dim, type))
+{ reserve(capacity); }
+
+int FeatureSet::padded_bytes(int dim, Type type) {
+	int bytes;
+	switch (type) {
+		case Type::FLOAT: bytes = dim * sizeof(float); break;
+		case Type::QUANTIZED: bytes = dim; break;
+		default: bytes = (dim + 63) / 64 * sizeof(uint64_t); break;
+	}
+	return (bytes + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+uint8_t* FeatureSet::allocate(int n, shared_ptr<uint8_t>& buf) const {
+	// padding bytes stay zero, so the distance kernels can run over the whole row
+	buf.reset(new uint8_t[(size_t)n * row_stride + ALIGN](), default_delete<uint8_t[]>());
+	uint8_t* aligned = buf.get();
+	while (reinterpret_cast<uintptr_t>(aligned) % ALIGN)
+		aligned++;
+	return aligned;
+}
+
+void FeatureSet::reserve(int n) {
+	if (n <= capacity) return;
+	n = max(n, capacity * 2);
+	shared_ptr<uint8_t> buf;
+	uint8_t* aligned = allocate(n, buf);
+	if (size())
+		memcpy(aligned, data, (size_t)size() * row_stride);
+	storage = move(buf);
+	data = aligned;
+	capacity = n;
+}
+
+void FeatureSet::resize(int n) {
+	int old = size();
+	reserve(n);
+	if (n > old)
+		memset(row(old), 0, (size_t)(n - old) * row_stride);
+	coor.resize(n);
+}
+
+void FeatureSet::append(const FeatureSet& r) {
+	m_assert(r.type_ == type_ && r.D == D);
+	int n = size();
+	reserve(n + r.size());
+	if (r.size())
+		memcpy(row(n), r.row(0), (size_t)r.size() * row_stride);
+	coor.insert(coor.end(), r.coor.begin(), r.coor.end());
+}
+
+uint8_t* FeatureSet::add_row(const Vec2D& c) {
+	int n = size();
+	resize(n + 1);
+	coor[n] = c;
+	return row(n);
+}
+
+void FeatureSet::swap(FeatureSet& r) {
+	using std::swap;
+	swap(coor, r.coor);
+	swap(type_, r.type_);
+	swap(D, r.D);
+	swap(row_stride, r.row_stride);
+	swap(capacity, r.capacity);
+	swap(storage, r.storage);
+	swap(data, r.data);
+}
+
+void FeatureSet::attach(int n, uint8_t* rows, shared_ptr<uint8_t> owner) {
+	m_assert(reinterpret_cast<uintptr_t>(rows) % ALIGN == 0);
+	storage = move(owner);
+	data = rows;
+	capacity = n;
+	coor.resize(n);
+}
+
+void FeatureSet::quantize(float factor) {
+	m_assert(type_ == Type::FLOAT);
+	FeatureSet ret(D, 0, Type::QUANTIZED);
+	const int n = size();
+	uint8_t* qdata = ret.allocate(n, ret.storage);
+	REP(i, n) {
+		const float* src = descriptor(i);
+		uint8_t* dst = qdata + (size_t)i * ret.row_stride;
+		REP(k, D)
+			dst[k] = (uint8_t)min(lround(src[k] * factor), 255L);
+	}
+	ret.data = qdata;
+	ret.capacity = n;
+	ret.coor = move(coor);
+	swap(ret);
+}
+
 // return half-shifted image coordinate
-vector<Descriptor> FeatureDetector::detect_feature(const Mat32f& img) const {
+FeatureSet FeatureDetector::detect_feature(const Mat32f& img, int width, int height) const {
 	auto ret = do_detect_feature(img);
 	// convert scale-coordinate to half-offset image coordinate
-	for (auto& d: ret) {
-		d.coor.x = (d.coor.x - 0.5) * img.width();
-		d.coor.y = (d.coor.y - 0.5) * img.height();
+	for (auto& c: ret.coor) {
+		c.x = (c.x - 0.5) * width;
+		c.y = (c.y - 0.5) * height;
 	}
 	return ret;
 }
 
 // return [0, 1] coordinate
-vector<Descriptor> SIFTDetector::do_detect_feature(const Mat32f& mat) const {
+FeatureSet SIFTDetector::do_detect_feature(const Mat32f& mat) const {
+	// the working image, the pyramid and the scratch images are reused for the next image
+	buffer_pool::Scope pool_scope;
 	// perform sift at this resolution
 	float ratio = SIFT_WORKING_SIZE * 2.0f / (mat.width() + mat.height());
-	Mat32f resized(mat.rows() * ratio, mat.cols() * ratio, 3);
+	Mat32f resized(mat.rows() * ratio, mat.cols() * ratio, mat.channels());
 	resize(mat, resized);
 
 	/*ScaleSpace ss(resized, NUM_OCTAVE, NUM_SCALE);
@@ -46,8 +148,10 @@ vector<Descriptor> SIFTDetector::do_detect_feature(const Mat32f& mat) const {
 	auto descp = sift.get_descriptor();*/
 	//print_debug("start!");
 	mySIFT mysift(resized,3,3,1.6);
-	auto descp = mysift.GetDescriptor();
-	return descp;
+	FeatureSet ret = move(mysift.GetDescriptor());
+	if (DESC_QUANTIZE)
+		ret.quantize(DESC_INT_FACTOR);
+	return ret;
 }
 
 BRIEFDetector::BRIEFDetector() {
@@ -57,7 +161,7 @@ BRIEFDetector::BRIEFDetector() {
 
 BRIEFDetector::~BRIEFDetector() {}
 
-vector<Descriptor> BRIEFDetector::do_detect_feature(const Mat32f& mat) const {
+FeatureSet BRIEFDetector::do_detect_feature(const Mat32f& mat) const {
 	ScaleSpace ss(mat, NUM_OCTAVE, NUM_SCALE);
 	DOGSpace sp(ss);
 
@@ -67,8 +171,34 @@ vector<Descriptor> BRIEFDetector::do_detect_feature(const Mat32f& mat) const {
 	//keyp = ort.work();
 	BRIEF brief(mat, keyp, *pattern);
 
-	auto ret = brief.get_descriptor();
-	return ret;
+	return brief.get_descriptor();
+}
+
+ORBDetector::ORBDetector() {
+	pattern.reset(new ORBPattern(ORB::gen_orb_pattern(ORB_NR_PAIR)));
+}
+
+ORBDetector::~ORBDetector() {}
+
+// return [0, 1] coordinate
+FeatureSet ORBDetector::do_detect_feature(const Mat32f& mat) const {
+	float ratio = SIFT_WORKING_SIZE * 2.0f / (mat.width() + mat.height());
+	Mat32f resized(mat.rows() * ratio, mat.cols() * ratio, mat.channels());
+	resize(mat, resized);
+	Mat32f grey = resized.channels() == 1 ? resized : rgb2grey(resized);
+	ORB orb(grey, *pattern);
+	return orb.get_descriptor();
+}
+
+unique_ptr<FeatureDetector> create_feature_detector() {
+	switch (FEATURE_DETECTOR) {
+		case 0:
+			return unique_ptr<FeatureDetector>(new SIFTDetector);
+		case 1:
+			return unique_ptr<FeatureDetector>(new ORBDetector);
+		default:
+			error_exit(ssprintf("Unknown FEATURE_DETECTOR %d\n", FEATURE_DETECTOR));
+	}
 }
 
 }
@@ -8,24 +8,107 @@
 #include "lib/mat.h"
 #include "lib/geometry.hh"
 #include "feature/dist.hh"
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 namespace pano {
 
 struct BriefPattern;	// forward declaration
+struct ORBPattern;
 
-struct Descriptor {
-	Vec2D coor;
-	std::vector<float> descriptor;
-
-	// square of euclidean. use now_thres to early-stop
-	float euclidean_sqr(const Descriptor& r, float now_thres) const {
-		return pano::euclidean_sqr(descriptor.data(), r.descriptor.data(), (int)descriptor.size(), now_thres);
-	}
+// Features of an image.
+// Descriptors are rows of a single N x D matrix, each row aligned to 32 bytes,
+// and coordinates are stored in a separate array.
+// A row is either D floats, D bytes (after quantize()), or D bits packed into uint64.
+class FeatureSet {
+	public:
+		static const int ALIGN = 32;	// in bytes
+
+		enum class Type {
+			FLOAT,
+			QUANTIZED,	// uint8
+			BINARY			// packed bits, compared by hamming distance
+		};
+
+		std::vector<Vec2D> coor;
+
+		FeatureSet() = default;
+		// dim: number of elements in a row. i.e. number of bits for BINARY
+		explicit FeatureSet(int dim, int capacity = 0, Type type = Type::FLOAT);
+
+		FeatureSet(FeatureSet&& r) { swap(r); }
+		FeatureSet& operator = (FeatureSet&& r) { swap(r); return *this; }
+		// avoid implicit deep copy
+		FeatureSet(const FeatureSet&) = delete;
+		FeatureSet& operator = (const FeatureSet&) = delete;
+
+		int size() const { return coor.size(); }
+		bool empty() const { return coor.empty(); }
+		// descriptor dimension
+		int dim() const { return D; }
+		Type type() const { return type_; }
+		bool quantized() const { return type_ == Type::QUANTIZED; }
+		bool binary() const { return type_ == Type::BINARY; }
+		// number of bytes between two rows, padded to ALIGN
+		int row_bytes() const { return row_stride; }
+
+		// access rows of the corresponding type
+		float* descriptor(int i) { return reinterpret_cast<float*>(row(i)); }
+		const float* descriptor(int i) const { return reinterpret_cast<const float*>(row(i)); }
+		const uint8_t* qdescriptor(int i) const { return row(i); }
+		uint64_t* bdescriptor(int i) { return reinterpret_cast<uint64_t*>(row(i)); }
+		const uint64_t* bdescriptor(int i) const { return reinterpret_cast<const uint64_t*>(row(i)); }
+
+		// append a feature. return its descriptor row, filled with zero
+		float* add(const Vec2D& c) { return reinterpret_cast<float*>(add_row(c)); }
+		uint64_t* add_binary(const Vec2D& c) { return reinterpret_cast<uint64_t*>(add_row(c)); }
+
+		// resize to n features. new rows are filled with zero
+		void resize(int n);
+		void reserve(int n);
+
+		// append all features of r, which must have the same type and dim
+		void append(const FeatureSet& r);
+
+		void swap(FeatureSet& r);
+
+		// use n rows in external memory (e.g. a mapped file), which is released with owner.
+		// rows must be aligned to ALIGN and spaced by row_bytes(). coor is resized to n.
+		// the rows are copied to own storage if the set grows
+		void attach(int n, uint8_t* rows, std::shared_ptr<uint8_t> owner);
+
+		// convert FLOAT descriptors to QUANTIZED by min(round(v * factor), 255)
+		void quantize(float factor);
+
+		// square of euclidean between descriptor i and r. use now_thres to early-stop.
+		// both sets must be FLOAT or QUANTIZED
+		float euclidean_sqr(int i, const FeatureSet& r, int j, float now_thres) const {
+			if (quantized())
+				return pano::euclidean_sqr(qdescriptor(i), r.qdescriptor(j), row_stride);
+			return pano::euclidean_sqr(descriptor(i), r.descriptor(j), D, now_thres);
+		}
+
+		// both sets must be BINARY
+		int hamming(int i, const FeatureSet& r, int j) const {
+			return pano::hamming(bdescriptor(i), r.bdescriptor(j), row_stride / sizeof(uint64_t));
+		}
 
-	int hamming(const Descriptor& r) const {
-		return pano::hamming(descriptor.data(), r.descriptor.data(), (int)descriptor.size());
-	}
+	protected:
+		Type type_ = Type::FLOAT;
+		int D = 0, row_stride = 0, capacity = 0;
+		std::shared_ptr<uint8_t> storage;
+		uint8_t* data = nullptr;	// aligned start of storage
+
+		uint8_t* row(int i) { return data + (size_t)i * row_stride; }
+		const uint8_t* row(int i) const { return data + (size_t)i * row_stride; }
+		uint8_t* add_row(const Vec2D& c);
+
+		// bytes of a row of dim elements, padded to ALIGN
+		static int padded_bytes(int dim, Type type);
+		// allocate a zero-filled aligned buffer of n rows
+		uint8_t* allocate(int n, std::shared_ptr<uint8_t>& buf) const;
 };
 
 // A Scale-Space point. used as intermediate result
@@ -46,13 +129,23 @@ class FeatureDetector {
 		FeatureDetector& operator = (const FeatureDetector&) = delete;
 
 		// return [-w/2,w/2] coordinated
-		std::vector<Descriptor> detect_feature(const Mat32f& img) const;
-		virtual std::vector<Descriptor> do_detect_feature(const Mat32f& img) const = 0;
+		FeatureSet detect_feature(const Mat32f& img) const
+		{ return detect_feature(img, img.width(), img.height()); }
+
+		// img: the image of size width x height, maybe downscaled
+		FeatureSet detect_feature(const Mat32f& img, int width, int height) const;
+
+		// the resolution a detector works at, or 0 if it uses the full resolution.
+		// detectors with a working size also accept grey images
+		virtual int working_size() const { return 0; }
+
+		virtual FeatureSet do_detect_feature(const Mat32f& img) const = 0;
 };
 
 class SIFTDetector : public FeatureDetector {
 	public:
-		std::vector<Descriptor> do_detect_feature(const Mat32f& img) const override;
+		int working_size() const override { return config::SIFT_WORKING_SIZE; }
+		FeatureSet do_detect_feature(const Mat32f& img) const override;
 };
 
 
@@ -61,10 +154,24 @@ class BRIEFDetector : public FeatureDetector {
 	public:
 		BRIEFDetector();
 		virtual ~BRIEFDetector();
-		std::vector<Descriptor> do_detect_feature(const Mat32f& img) const override;
+		FeatureSet do_detect_feature(const Mat32f& img) const override;
 
 	protected:
 		std::unique_ptr<BriefPattern> pattern;
 };
 
+class ORBDetector : public FeatureDetector {
+	public:
+		ORBDetector();
+		virtual ~ORBDetector();
+		int working_size() const override { return config::SIFT_WORKING_SIZE; }
+		FeatureSet do_detect_feature(const Mat32f& img) const override;
+
+	protected:
+		std::unique_ptr<ORBPattern> pattern;
+};
+
+// the detector chosen by FEATURE_DETECTOR
+std::unique_ptr<FeatureDetector> create_feature_detector();
+
 }
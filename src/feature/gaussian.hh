@@ -6,6 +6,7 @@
 #include <memory>
 #include <vector>
 #include "lib/mat.h"
+#include "lib/convolve.hh"
 #include "lib/utils.hh"
 #include "lib/timer.hh"
 
@@ -25,67 +26,20 @@ class GaussianBlur {
 	public:
 		GaussianBlur(float sigma): sigma(sigma), gcache(sigma) {}
 
-		// TODO faster convolution
+		// blur an image of float-based pixels, each channel independently.
+		// a pixel type T is treated as sizeof(T) / sizeof(float) float channels.
 		template <typename T>
 		Mat<T> blur(const Mat<T>& img) const {
-			m_assert(img.channels() == 1);
+			static_assert(sizeof(T) % sizeof(float) == 0,
+					"GaussianBlur only works on float-based pixels");
 			TotalTimer tm("gaussianblur");
 			const int w = img.width(), h = img.height();
 			Mat<T> ret(h, w, img.channels());
-
-			const int kw = gcache.kw;
-			const int center = kw / 2;
-			float * kernel = gcache.kernel;
-
-			std::vector<T> cur_line_mem(center * 2 + std::max(w, h), 0);
-			T *cur_line = cur_line_mem.data() + center;
-
-			// apply to columns
-			REP(j, w){
-				const T* src = img.ptr(0, j);
-				// copy a column of src
-				REP(i, h) {
-					cur_line[i] = *src;
-					src += w;
-				}
-
-				// pad the border with border value
-				T v0 = cur_line[0];
-				for (int i = 1; i <= center; i ++)
-					cur_line[-i] = v0;
-				v0 = cur_line[h - 1];
-				for (int i = 0; i < center; i ++)
-					cur_line[h + i] = v0;
-
-				T *dest = ret.ptr(0, j);
-				REP(i, h) {
-					T tmp{0};
-					for (int k = -center; k <= center; k ++)
-						tmp += cur_line[i + k] * kernel[k];
-					*dest = tmp;
-					dest += w;
-				}
-			}
-
-			// apply to rows
-			REP(i, h) {
-				T *dest = ret.ptr(i);
-				memcpy(cur_line, dest, sizeof(T) * w);
-				{	// pad the border
-					T v0 = cur_line[0];
-					for (int j = 1; j <= center; j ++)
-						cur_line[-j] = v0;
-					v0 = cur_line[w - 1];
-					for (int j = 0; j < center; j ++)
-						cur_line[center + j] = v0;
-				}
-				REP(j, w) {
-					T tmp{0};
-					for (int k = -center; k <= center; k ++)
-						tmp += cur_line[j + k] * kernel[k];
-					*(dest ++) = tmp;
-				}
-			}
+			const int ratio = sizeof(T) / sizeof(float);
+			convolve_separable(
+					reinterpret_cast<const float*>(img.ptr()), img.stride() * ratio,
+					reinterpret_cast<float*>(ret.ptr()), ret.stride() * ratio,
+					w, h, img.channels() * ratio, gcache.kernel, gcache.kw / 2);
 			return ret;
 		}
 };
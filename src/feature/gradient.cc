@@ -0,0 +1,142 @@
+//File: gradient.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "gradient.hh"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "lib/simd.hh"
+using namespace std;
+
+namespace {
+
+using namespace pano;
+
+// atan(a) ~ a + a * s * (C3 + s * (C5 + s * C7)), s = a * a, a in [0, 1]
+// http://math.stackexchange.com/questions/1098487/atan2-faster-approximation
+const float C3 = -0.327622764f, C5 = 0.15931422f, C7 = -0.0464964749f;
+const float PI_F = 3.14159265358979f;
+
+typedef void (*GradientFunc)(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori);
+
+inline void gradient_range(
+		const float* above, const float* cur, const float* below,
+		float* mag, float* ori, int begin, int end) {
+	for (int x = begin; x < end; ++x) {
+		float dx = cur[x + 1] - cur[x - 1],
+					dy = below[x] - above[x];
+		float absx = fabs(dx), absy = fabs(dy);
+		// a == 0 when the gradient vanishes, which gives orientation 0
+		float a = min(absx, absy) / max(max(absx, absy), FLT_MIN);
+		float s = a * a;
+		float r = ((C7 * s + C5) * s + C3) * s * a + a;
+		if (absy > absx) r = PI_F / 2 - r;
+		if (dx < 0) r = PI_F - r;
+		if (dy < 0) r = 2 * PI_F - r;
+		mag[x] = sqrt(dx * dx + dy * dy);
+		ori[x] = r;
+	}
+}
+
+void gradient_scalar(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori) {
+	gradient_range(above, cur, below, mag, ori, 0, n);
+}
+
+#ifdef PANO_SIMD_DISPATCH
+
+PANO_TARGET("sse2")
+void gradient_sse2(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori) {
+	const __m128 sign = _mm_set1_ps(-0.f), zero = _mm_setzero_ps(),
+				tiny = _mm_set1_ps(FLT_MIN),
+				c3 = _mm_set1_ps(C3), c5 = _mm_set1_ps(C5), c7 = _mm_set1_ps(C7),
+				half_pi = _mm_set1_ps(PI_F / 2), pi = _mm_set1_ps(PI_F),
+				two_pi = _mm_set1_ps(2 * PI_F);
+	// m ? b : a
+	auto select = [](__m128 m, __m128 a, __m128 b) {
+		return _mm_or_ps(_mm_and_ps(m, b), _mm_andnot_ps(m, a));
+	};
+	int x = 0;
+	for (; x + 4 <= n; x += 4) {
+		__m128 dx = _mm_sub_ps(_mm_loadu_ps(cur + x + 1), _mm_loadu_ps(cur + x - 1)),
+					 dy = _mm_sub_ps(_mm_loadu_ps(below + x), _mm_loadu_ps(above + x));
+		__m128 absx = _mm_andnot_ps(sign, dx), absy = _mm_andnot_ps(sign, dy);
+		__m128 a = _mm_div_ps(_mm_min_ps(absx, absy),
+				_mm_max_ps(_mm_max_ps(absx, absy), tiny));
+		__m128 s = _mm_mul_ps(a, a);
+		__m128 r = _mm_add_ps(_mm_mul_ps(c7, s), c5);
+		r = _mm_add_ps(_mm_mul_ps(r, s), c3);
+		r = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r, s), a), a);
+		r = select(_mm_cmpgt_ps(absy, absx), r, _mm_sub_ps(half_pi, r));
+		r = select(_mm_cmplt_ps(dx, zero), r, _mm_sub_ps(pi, r));
+		r = select(_mm_cmplt_ps(dy, zero), r, _mm_sub_ps(two_pi, r));
+		_mm_storeu_ps(mag + x, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+		_mm_storeu_ps(ori + x, r);
+	}
+	gradient_range(above, cur, below, mag, ori, x, n);
+}
+
+PANO_TARGET("avx2,fma")
+void gradient_avx2(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori) {
+	const __m256 sign = _mm256_set1_ps(-0.f), zero = _mm256_setzero_ps(),
+				tiny = _mm256_set1_ps(FLT_MIN),
+				c3 = _mm256_set1_ps(C3), c5 = _mm256_set1_ps(C5), c7 = _mm256_set1_ps(C7),
+				half_pi = _mm256_set1_ps(PI_F / 2), pi = _mm256_set1_ps(PI_F),
+				two_pi = _mm256_set1_ps(2 * PI_F);
+	int x = 0;
+	for (; x + 8 <= n; x += 8) {
+		__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(cur + x + 1), _mm256_loadu_ps(cur + x - 1)),
+					 dy = _mm256_sub_ps(_mm256_loadu_ps(below + x), _mm256_loadu_ps(above + x));
+		__m256 absx = _mm256_andnot_ps(sign, dx), absy = _mm256_andnot_ps(sign, dy);
+		__m256 a = _mm256_div_ps(_mm256_min_ps(absx, absy),
+				_mm256_max_ps(_mm256_max_ps(absx, absy), tiny));
+		__m256 s = _mm256_mul_ps(a, a);
+		__m256 r = _mm256_fmadd_ps(c7, s, c5);
+		r = _mm256_fmadd_ps(r, s, c3);
+		r = _mm256_fmadd_ps(_mm256_mul_ps(r, s), a, a);
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(half_pi, r), _mm256_cmp_ps(absy, absx, _CMP_GT_OQ));
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(pi, r), _mm256_cmp_ps(dx, zero, _CMP_LT_OQ));
+		r = _mm256_blendv_ps(r, _mm256_sub_ps(two_pi, r), _mm256_cmp_ps(dy, zero, _CMP_LT_OQ));
+		_mm256_storeu_ps(mag + x, _mm256_sqrt_ps(_mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy))));
+		_mm256_storeu_ps(ori + x, r);
+	}
+	gradient_range(above, cur, below, mag, ori, x, n);
+}
+
+#endif
+
+GradientFunc select_gradient() {
+#ifdef PANO_SIMD_DISPATCH
+	switch (simd_level()) {
+		case SIMDLevel::AVX512:
+		case SIMDLevel::AVX2:
+			return gradient_avx2;
+		case SIMDLevel::SSE2:
+			return gradient_sse2;
+		default:
+			break;
+	}
+#endif
+	return gradient_scalar;
+}
+
+}	// namespace
+
+namespace pano {
+
+void gradient_row(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori) {
+	static const GradientFunc func = select_gradient();
+	func(above, cur, below, n, mag, ori);
+}
+
+}
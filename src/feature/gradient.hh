@@ -0,0 +1,17 @@
+//File: gradient.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+
+namespace pano {
+
+// Gradient magnitude and orientation of n pixels in a row, by central difference.
+// above, cur and below point to the same column in rows y - 1, y, y + 1,
+// and cur[-1], cur[n] must be valid.
+// Orientation is atan2(dy, dx) in [0, 2 * pi), and 0 where the gradient vanishes.
+// atan2 is a polynomial approximation, with absolute error below 1e-5.
+void gradient_row(
+		const float* above, const float* cur, const float* below,
+		int n, float* mag, float* ori);
+
+}
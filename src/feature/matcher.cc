@@ -2,7 +2,10 @@
 // Date: Fri May 03 17:02:09 2013 +0800
 // Author: Yuxin Wu <ppwwyyxxc@gmail.com>
 
+#include <algorithm>
+#include <cstdio>
 #include <limits>
+#include <numeric>
 #include <flann/flann.hpp>
 #include "matcher.hh"
 #include "lib/timer.hh"
@@ -21,6 +24,32 @@ namespace flann {
 
 namespace pano {
 
+namespace {
+
+// rows of queries and of the packed train set in a tile of the brute-force matcher.
+// a tile of dot products is 96 x 256 floats, and 256 packed rows of SIFT fit in L2
+const int BRUTE_FORCE_QUERY_BLOCK = 96;
+const int BRUTE_FORCE_TRAIN_BLOCK = 256;
+
+// the descriptors as float rows: in place for FLOAT, or converted into buf.
+// uint8 values and their dot products are exact in float
+const float* float_rows(const FeatureSet& feat, vector<float>& buf, size_t& stride) {
+	const int D = feat.dim();
+	if (! feat.quantized()) {
+		stride = feat.row_bytes() / sizeof(float);
+		return feat.descriptor(0);
+	}
+	stride = D;
+	buf.resize((size_t)feat.size() * D);
+	REP(i, feat.size()) {
+		const uint8_t* p = feat.qdescriptor(i);
+		copy(p, p + D, buf.data() + (size_t)i * D);
+	}
+	return buf.data();
+}
+
+}
+
 MatchData FeatureMatcher::match() const {
 	static const float REJECT_RATIO_SQR = MATCH_REJECT_NEXT_RATIO * MATCH_REJECT_NEXT_RATIO;
 	TotalTimer tm("matcher");
@@ -28,7 +57,7 @@ MatchData FeatureMatcher::match() const {
 	int l1 = feat1.size(), l2 = feat2.size();
 	// loop over the smaller one to speed up
 	bool rev = l1 > l2;
-	const vector<Descriptor> *pf1, *pf2;
+	const FeatureSet *pf1, *pf2;
 	if (rev) {
 		swap(l1, l2);
 		pf1 = &feat2, pf2 = &feat1;
@@ -36,81 +65,356 @@ MatchData FeatureMatcher::match() const {
 		pf1 = &feat1, pf2 = &feat2;
 	}
 
-	MatchData ret;
+	// squared distance to the best and the second best, and the index of the best
+	vector<float> best(l1, numeric_limits<float>::max()), second(l1, numeric_limits<float>::max());
+	vector<int> best_idx(l1, -1);
+	auto update = [&](int k, int kk, float dist) {
+		if (dist < best[k]) {
+			second[k] = best[k];
+			best[k] = dist;
+			best_idx[k] = kk;
+		} else {
+			update_min(second[k], dist);
+		}
+	};
 
+	if (feat1.binary()) {
 #pragma omp parallel for schedule(dynamic)
-	REP(k, l1) {
-		const Descriptor& i = (*pf1)[k];
-		int min_idx = -1;
-
-		float min = numeric_limits<float>::max(),
-					next_min = min;
-		REP(kk, l2) {
-			float dist = i.euclidean_sqr((*pf2)[kk], next_min);
-			if (dist < min) {
-				next_min = min;
-				min = dist;
-				min_idx = kk;
-			} else {
-				update_min(next_min, dist);
+		REP(k, l1)
+			REP(kk, l2)		// hamming distance is compared with the ratio, and L2 with its square
+				update(k, kk, sqr((float)pf1->hamming(k, *pf2, kk)));
+	} else if (l1 && l2) {
+		// |a - b|^2 = |a|^2 + |b|^2 - 2 a.b, where the dot products of a tile
+		// are computed as a matrix product
+		const int D = pf1->dim();
+		vector<float> buf1, buf2;
+		size_t stride1, stride2;
+		const float* rows1 = float_rows(*pf1, buf1, stride1);
+		const float* rows2 = float_rows(*pf2, buf2, stride2);
+		auto norm_sqr = [D](const float* p, size_t stride, int n) {
+			vector<float> ret(n);
+			REP(i, n)
+				ret[i] = inner_product(p + i * stride, p + i * stride + D, p + i * stride, 0.f);
+			return ret;
+		};
+		vector<float> norm1 = norm_sqr(rows1, stride1, l1),
+			norm2 = norm_sqr(rows2, stride2, l2);
+
+		const int nr_panel = (l2 + DOT_PANEL - 1) / DOT_PANEL;
+		vector<float> packed((size_t)nr_panel * DOT_PANEL * D);
+		pack_dot_panels(rows2, stride2, l2, D, packed.data());
+
+		const int nr_block = (l1 + BRUTE_FORCE_QUERY_BLOCK - 1) / BRUTE_FORCE_QUERY_BLOCK;
+#pragma omp parallel for schedule(dynamic)
+		REP(b, nr_block) {
+			vector<float> dot((size_t)BRUTE_FORCE_QUERY_BLOCK * BRUTE_FORCE_TRAIN_BLOCK);
+			const int k0 = b * BRUTE_FORCE_QUERY_BLOCK,
+						nk = min(BRUTE_FORCE_QUERY_BLOCK, l1 - k0);
+			for (int kk0 = 0; kk0 < l2; kk0 += BRUTE_FORCE_TRAIN_BLOCK) {
+				const int nkk = min(BRUTE_FORCE_TRAIN_BLOCK, l2 - kk0);
+				dot_packed(rows1 + k0 * stride1, stride1, nk,
+						packed.data() + (size_t)kk0 * D, nkk, D,
+						dot.data(), BRUTE_FORCE_TRAIN_BLOCK);
+				REP(i, nk) {
+					// keep the best two in registers within the tile
+					const int k = k0 + i;
+					const float* d = dot.data() + i * BRUTE_FORCE_TRAIN_BLOCK;
+					const float* nb = norm2.data() + kk0;
+					float m1 = best[k], m2 = second[k];
+					int idx = best_idx[k];
+					REP(j, nkk) {
+						float dist = norm1[k] + nb[j] - 2 * d[j];
+						if (dist < m2) {
+							dist = max(dist, 0.f);
+							if (dist < m1) {
+								m2 = m1, m1 = dist;
+								idx = kk0 + j;
+							} else
+								m2 = dist;
+						}
+					}
+					best[k] = m1, second[k] = m2, best_idx[k] = idx;
+				}
 			}
 		}
-		if (min > REJECT_RATIO_SQR * next_min)
-			continue;
+	}
 
-		m_assert(min_idx != -1);
-#pragma omp critical
-		ret.data.emplace_back(k, min_idx);
+	MatchData ret;
+	REP(k, l1) {
+		if (best_idx[k] == -1 || best[k] > REJECT_RATIO_SQR * second[k])
+			continue;
+		ret.data.emplace_back(k, best_idx[k]);
 	}
 	if (rev)
 		ret.reverse();
 	return ret;
 }
 
-void PairWiseMatcher::build() {
+flann::IndexParams FlannParams::index_params() const {
+	switch (algo) {
+		case 0:
+			return flann::KDTreeIndexParams(nr_kdtree);
+		case 1:
+			return flann::KMeansIndexParams(branching, iterations, flann::FLANN_CENTERS_RANDOM, cb_index);
+		case 2:
+			return flann::HierarchicalClusteringIndexParams(
+					branching, flann::FLANN_CENTERS_RANDOM, nr_kdtree);
+		default:
+			// autotuning takes minutes per image, and is only done by calibrate_flann
+			error_exit(ssprintf("Unknown FLANN_INDEX %d. "
+						"Run calibrate_flann to autotune the index.\n", algo));
+	}
+}
+
+bool FlannParams::from_autotuned(const flann::IndexParams& tuned) {
+	using flann::get_param;
+	checks = get_param<flann::SearchParams>(tuned, "search_params").checks;
+	switch (get_param<flann::flann_algorithm_t>(tuned, "algorithm")) {
+		case flann::FLANN_INDEX_KDTREE:
+			algo = 0;
+			nr_kdtree = get_param<int>(tuned, "trees");
+			return true;
+		case flann::FLANN_INDEX_KMEANS:
+			algo = 1;
+			branching = get_param<int>(tuned, "branching");
+			iterations = get_param<int>(tuned, "iterations");
+			cb_index = get_param<float>(tuned, "cb_index");
+			return true;
+		default:
+			return false;
+	}
+}
+
+string FlannParams::to_config() const {
+	string ret = ssprintf("FLANN_INDEX %d\n", algo);
+	if (algo == 0 || algo == 2)
+		ret += ssprintf("FLANN_NR_KDTREE %d\n", nr_kdtree);
+	if (algo == 1 || algo == 2)
+		ret += ssprintf("FLANN_BRANCHING %d\n", branching);
+	if (algo == 1)
+		ret += ssprintf("FLANN_KMEANS_ITERATIONS %d\nFLANN_KMEANS_CB_INDEX %g\n", iterations, cb_index);
+	ret += ssprintf("FLANN_CHECKS %d\n", checks);
+	return ret;
+}
+
+namespace {
+
+// knn with k=2 of all rows in query, then apply the ratio test
+// reject_ratio: compared with the distances returned by the index
+template <typename Index, typename T>
+MatchData knn_match(const Index& t, const flann::Matrix<T>& query, float reject_ratio) {
+	typedef typename Index::DistanceType DistanceType;
+	MatchData ret;
+	const int n = query.rows;
+
+	vector<int> indices_buf(n * 2, -1);
+	vector<DistanceType> dists_buf(n * 2);
+	flann::Matrix<int> indices(indices_buf.data(), n, 2);
+	flann::Matrix<DistanceType> dists(dists_buf.data(), n, 2);
+	t.knnSearch(query, indices, dists, 2, FlannParams().search_params());
+	REP(k, n) {
+		int mini = indices[k][0];
+		// LSH may find less than two neighbors
+		if (mini < 0 || indices[k][1] < 0)
+			continue;
+		float mind = dists[k][0], mind2 = dists[k][1];
+		if (mind > reject_ratio * mind2)
+			continue;
+		ret.data.emplace_back(k, mini);
+	}
+	return ret;
+}
+
+// build each index, or replace it by the one saved in index_file(i) if it exists.
+// new indices are saved
+template <typename Distance, typename DataFunc>
+void build_or_load(vector<flann::Index<Distance>>& indices, DataFunc data,
+		const function<string(int)>& index_file) {
+	const int n = indices.size();
+	int nr_loaded = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:nr_loaded)
+	REP(i, n) {
+		const string fname = index_file ? index_file(i) : "";
+		if (fname.size() && exists_file(fname.c_str())) {
+			// flann reports an invalid file by exception
+			try {
+				indices[i] = flann::Index<Distance>(data(i), flann::SavedIndexParams(fname));
+				nr_loaded ++;
+				continue;
+			} catch (const flann::FLANNException& e) {
+				print_debug("Rebuild index %s: %s\n", fname.c_str(), e.what());
+			}
+		}
+		indices[i].buildIndex();
+		if (fname.empty())
+			continue;
+		// write to a temporary file of this writer then rename, as the feature cache does
+		string tmp = temp_file_name(fname);
+		try {
+			indices[i].save(tmp);
+			if (rename(tmp.c_str(), fname.c_str()) != 0)
+				remove(tmp.c_str());
+		} catch (const flann::FLANNException& e) {
+			print_debug("Failed to save index %s: %s\n", fname.c_str(), e.what());
+			remove(tmp.c_str());
+		}
+	}
+	if (nr_loaded)
+		print_debug("Loaded %d of %d indices from the feature cache\n", nr_loaded, n);
+}
+
+}
+
+flann::Matrix<float> descriptor_matrix(const FeatureSet& feat) {
+	return flann::Matrix<float>(
+			const_cast<float*>(feat.descriptor(0)), feat.size(), feat.dim(),
+			feat.row_bytes());
+}
+
+flann::Matrix<unsigned char> byte_matrix(const FeatureSet& feat) {
+	// include the zero padding, as the integer kernels work on whole rows
+	return flann::Matrix<unsigned char>(
+			const_cast<uint8_t*>(feat.qdescriptor(0)), feat.size(), feat.row_bytes(),
+			feat.row_bytes());
+}
+
+flann::Matrix<float> PairWiseMatcher::descriptor_matrix(int i) const
+{ return pano::descriptor_matrix(feats[i]); }
+
+flann::Matrix<unsigned char> PairWiseMatcher::byte_matrix(int i) const
+{ return pano::byte_matrix(feats[i]); }
+
+void PairWiseMatcher::build(const function<string(int)>& index_file) {
 	GuardedTimer tm("BuildTrees");
-	for (auto& feat: feats)	{
-		float* buf = new float[feat.size() * D];
-		bufs.emplace_back(buf);
-		REP(i, feat.size()) {
-			float* row = buf + D * i;
-			memcpy(row, feat[i].descriptor.data(), D * sizeof(float));
+	if (! feats[0].binary()) {
+		int max_size = 0;
+		for (auto& f : feats)
+			update_max(max_size, f.size());
+		brute_force = max_size <= BRUTE_FORCE_MATCH_MAX_FEATURE;
+		if (brute_force) {
+			print_debug("Match by brute force: at most %d features in an image, "
+					"BRUTE_FORCE_MATCH_MAX_FEATURE=%d\n", max_size, BRUTE_FORCE_MATCH_MAX_FEATURE);
+			return;
 		}
-		flann::Matrix<float> points(buf, feat.size(), D);
-		trees.emplace_back(points, flann::KDTreeIndexParams(FLANN_NR_KDTREE));	// TODO param
 	}
-#pragma omp parallel for schedule(dynamic)
-	REP(i, (int)trees.size())
-		trees[i].buildIndex();
+	const int n = feats.size();
+	// an index can't be copied by a reallocation before it's built. e.g. FLANN crashes on k-means
+	lsh.reserve(n), qtrees.reserve(n), trees.reserve(n);
+	if (feats[0].binary()) {
+		REP(i, n)
+			lsh.emplace_back(byte_matrix(i), flann::LshIndexParams(
+						FLANN_LSH_NR_TABLE, FLANN_LSH_KEY_SIZE, FLANN_LSH_MULTI_PROBE));
+		build_or_load(lsh, [&](int i) { return byte_matrix(i); }, index_file);
+	} else if (feats[0].quantized()) {
+		REP(i, n)
+			qtrees.emplace_back(byte_matrix(i), FlannParams().index_params());
+		build_or_load(qtrees, [&](int i) { return byte_matrix(i); }, index_file);
+	} else {
+		REP(i, n)
+			trees.emplace_back(descriptor_matrix(i), FlannParams().index_params());
+		build_or_load(trees, [&](int i) { return descriptor_matrix(i); }, index_file);
+	}
 }
 
 MatchData PairWiseMatcher::match(int i, int j) const {
 	static const float REJECT_RATIO_SQR = MATCH_REJECT_NEXT_RATIO * MATCH_REJECT_NEXT_RATIO;
-	MatchData ret;
-	auto source = feats.at(i),
-			 target = feats.at(j);
-	auto& t = trees[j];
-
-	float* buf = new float[source.size() * D];
-	REP(i, source.size()) {
-		float* row = buf + D * i;
-		memcpy(row, source[i].descriptor.data(), D * sizeof(float));
+	if (brute_force)
+		return FeatureMatcher(feats[i], feats[j]).match();
+	if (feats[0].binary())
+		return knn_match(lsh[j], byte_matrix(i), MATCH_REJECT_NEXT_RATIO);
+	if (feats[0].quantized())
+		return knn_match(qtrees[j], byte_matrix(i), REJECT_RATIO_SQR);
+	return knn_match(trees[j], descriptor_matrix(i), REJECT_RATIO_SQR);
+}
+
+GlobalMatcher::GlobalMatcher(const vector<FeatureSet>& feats, int k):
+	feats(feats), k(k), all(feats.at(0).dim(), 0, feats[0].type()) {
+	offset.push_back(0);
+	for (auto& f : feats) {
+		all.append(f);
+		offset.push_back(all.size());
 	}
-	flann::Matrix<float> query(buf, source.size(), D);
-
-	flann::Matrix<int> indices(new int[source.size() * 2], source.size(), 2);
-	flann::Matrix<float> dists(new float[source.size() * 2], source.size(), 2);
-	t.knnSearch(query, indices, dists, 2, flann::SearchParams(128));	// TODO param
-	REP(i, source.size()) {
-		int mini = indices[i][0];
-		float mind = dists[i][0], mind2 = dists[i][1];
-		if (mind > REJECT_RATIO_SQR * mind2)
-			continue;
-		ret.data.emplace_back(i, mini);
+}
+
+map<pair<int, int>, MatchData> GlobalMatcher::match() const {
+	GuardedTimer tm("GlobalMatcher::match()");
+	static const float REJECT_RATIO_SQR = MATCH_REJECT_NEXT_RATIO * MATCH_REJECT_NEXT_RATIO;
+	if (all.binary()) {
+		flann::Index<HammingU64> index(byte_matrix(all), flann::LshIndexParams(
+					FLANN_LSH_NR_TABLE, FLANN_LSH_KEY_SIZE, FLANN_LSH_MULTI_PROBE));
+		index.buildIndex();
+		return knn_match_all(index, byte_matrix(all), MATCH_REJECT_NEXT_RATIO);
+	}
+	if (all.quantized()) {
+		flann::Index<L2U8> index(byte_matrix(all), FlannParams().index_params());
+		index.buildIndex();
+		return knn_match_all(index, byte_matrix(all), REJECT_RATIO_SQR);
+	}
+	flann::Index<L2SSE> index(descriptor_matrix(all), FlannParams().index_params());
+	index.buildIndex();
+	return knn_match_all(index, descriptor_matrix(all), REJECT_RATIO_SQR);
+}
+
+template <typename Index, typename T>
+map<pair<int, int>, MatchData> GlobalMatcher::knn_match_all(
+		const Index& index, const flann::Matrix<T>& query, float reject_ratio) const {
+	typedef typename Index::DistanceType DistanceType;
+	const int n = feats.size();
+	// one more neighbour, for the feature itself
+	const int K = k + 1;
+	auto image_of = [&](int idx) {
+		return upper_bound(offset.begin(), offset.end(), idx) - offset.begin() - 1;
+	};
+
+	// matches from image i to images after it
+	vector<map<int, MatchData>> matches(n);
+#pragma omp parallel for schedule(dynamic)
+	REP(i, n) {
+		const int nq = feats[i].size();
+		if (! nq) continue;
+		vector<int> indices_buf(nq * K, -1);
+		vector<DistanceType> dists_buf(nq * K);
+		flann::Matrix<int> indices(indices_buf.data(), nq, K);
+		flann::Matrix<DistanceType> dists(dists_buf.data(), nq, K);
+		index.knnSearch(
+				flann::Matrix<T>(query[offset[i]], nq, query.cols, query.stride),
+				indices, dists, K, FlannParams().search_params());
+
+		// the two nearest neighbours in each image, within the k results
+		struct Candidate { int img, idx; float d1, d2; };
+		vector<Candidate> cands;
+		REP(q, nq) {
+			cands.clear();
+			float last = -1;	// distance of the k-th neighbour
+			REP(t, K) {
+				int idx = indices[q][t];
+				if (idx < 0) break;
+				last = dists[q][t];
+				int img = image_of(idx);
+				if (img <= i) continue;
+				auto itr = find_if(cands.begin(), cands.end(),
+						[&](const Candidate& c) { return c.img == img; });
+				if (itr == cands.end())
+					cands.push_back(Candidate{img, idx - offset[img], last, -1});
+				else if (itr->d2 < 0)
+					itr->d2 = last;
+			}
+			for (auto& c : cands) {
+				// without a second neighbour in the image, the k-th one bounds it from below
+				float d2 = c.d2 >= 0 ? c.d2 : last;
+				if (c.d2 < 0 && d2 == c.d1)
+					continue;
+				if (c.d1 > reject_ratio * d2)
+					continue;
+				matches[i][c.img].data.emplace_back(q, c.idx);
+			}
+		}
 	}
-	delete[] indices.ptr();
-	delete[] dists.ptr();
-	delete[] buf;
+
+	map<pair<int, int>, MatchData> ret;
+	REP(i, n)
+		for (auto& m : matches[i])
+			ret[make_pair(i, m.first)] = move(m.second);
 	return ret;
 }
 
@@ -3,6 +3,10 @@
 // Author: Yuxin Wu <ppwwyyxxc@gmail.com>
 
 #pragma once
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
 #include <vector>
 #include <flann/flann.hpp>
 #include "feature.hh"
@@ -23,11 +27,13 @@ class MatchData {
 		}
 };
 
+// Exact matching by comparing all pairs of features.
+// Distances of float and quantized descriptors are computed by tiles of dot products.
 class FeatureMatcher {
 	protected:
-		const std::vector<Descriptor> &feat1, &feat2;
+		const FeatureSet &feat1, &feat2;
 	public:
-		FeatureMatcher(const std::vector<Descriptor>& f1, const std::vector<Descriptor>& f2):
+		FeatureMatcher(const FeatureSet& f1, const FeatureSet& f2):
 			feat1(f1), feat2(f2) { }
 
 		FeatureMatcher(const FeatureMatcher&) = delete;
@@ -36,12 +42,40 @@ class FeatureMatcher {
 		MatchData match() const;
 };
 
+// views of the descriptors of feat in place, as FLANN matrices
+flann::Matrix<float> descriptor_matrix(const FeatureSet& feat);
+// the rows as bytes, for quantized or binary descriptors
+flann::Matrix<unsigned char> byte_matrix(const FeatureSet& feat);
+
+// the index for float and quantized descriptors, by default as in the FLANN_* config
+struct FlannParams {
+	int algo = config::FLANN_INDEX;	// 0: randomized kd-trees. 1: hierarchical k-means. 2: hierarchical clustering
+	int nr_kdtree = config::FLANN_NR_KDTREE;				// of 0 and 2
+	int branching = config::FLANN_BRANCHING;				// of 1 and 2
+	int iterations = config::FLANN_KMEANS_ITERATIONS;	// of 1
+	float cb_index = config::FLANN_KMEANS_CB_INDEX;		// of 1
+	int checks = config::FLANN_CHECKS;
+
+	flann::IndexParams index_params() const;
+	flann::SearchParams search_params() const
+	{ return flann::SearchParams(checks); }
+
+	// the parameters chosen by a flann::AutotunedIndex.
+	// return false if it chose linear search
+	bool from_autotuned(const flann::IndexParams& tuned);
+
+	// the settings as lines of config.cfg
+	std::string to_config() const;
+};
+
 class PairWiseMatcher {
 	public:
-		explicit PairWiseMatcher(
-				const std::vector<std::vector<Descriptor>>& feats)
-			: D(feats.at(0).at(0).descriptor.size()), feats(feats)
-		{ build(); }
+		// index_file(i): where to load the index of image i from, or save it to after building.
+		// only called when the indices are used. empty to always build
+		explicit PairWiseMatcher(const std::vector<FeatureSet>& feats,
+				const std::function<std::string(int)>& index_file = nullptr)
+			: D(feats.at(0).dim()), feats(feats)
+		{ build(index_file); }
 
 		PairWiseMatcher(const PairWiseMatcher&) = delete;
 		PairWiseMatcher& operator = (const PairWiseMatcher&) = delete;
@@ -49,18 +83,49 @@ class PairWiseMatcher {
 		// return pair of <idx in i, idx in j>
 		MatchData match(int i, int j) const;
 
-		~PairWiseMatcher() {
-			for (auto& p: bufs) delete[] p;
-		}
-
 	protected:
 		const int D; // feature dimension
-		const std::vector<std::vector<Descriptor>> &feats;
+		const std::vector<FeatureSet> &feats;
+		// all images have few features, so FeatureMatcher is faster than the indices
+		bool brute_force = false;
 
+		// the indices refer to the descriptor matrix of feats in place.
+		// one of them is used, depending on the type of the descriptors
 		std::vector<flann::Index<pano::L2SSE>> trees;
-		std::vector<float*> bufs;	// index buffer is managed manually
+		std::vector<flann::Index<pano::L2U8>> qtrees;
+		std::vector<flann::Index<pano::HammingU64>> lsh;
+
+		void build(const std::function<std::string(int)>& index_file);
+
+		// a view of the descriptor matrix of feats[i]
+		flann::Matrix<float> descriptor_matrix(int i) const;
+		// a view of the rows of feats[i] as bytes, for quantized or binary descriptors
+		flann::Matrix<unsigned char> byte_matrix(int i) const;
+};
+
+// Match all images with a single index of all descriptors, as in Brown & Lowe.
+// Each feature is queried once for its k nearest neighbours among all images,
+// and the neighbours are bucketed by image.
+// The cost grows linearly with the number of images, instead of quadratically.
+class GlobalMatcher {
+	public:
+		GlobalMatcher(const std::vector<FeatureSet>& feats, int k);
 
-		void build();
+		GlobalMatcher(const GlobalMatcher&) = delete;
+		GlobalMatcher& operator = (const GlobalMatcher&) = delete;
+
+		// matches <idx in i, idx in j> of all pairs i < j that have any
+		std::map<std::pair<int, int>, MatchData> match() const;
+
+	protected:
+		const std::vector<FeatureSet>& feats;
+		const int k;
+		FeatureSet all;		// features of all images
+		std::vector<int> offset;	// index of the first feature of each image in all, and the total
+
+		template <typename Index, typename T>
+		std::map<std::pair<int, int>, MatchData> knn_match_all(
+				const Index& index, const flann::Matrix<T>& query, float reject_ratio) const;
 };
 
 }
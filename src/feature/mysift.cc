@@ -1,68 +1,110 @@
 #include "mysift.h"
+#include <cstring>
+#include <map>
+#include <mutex>
 #include "lib/imgproc.hh"
-#include "lodepng/lodepng.h"
+#include "lib/convolve.hh"
+#include "lib/timer.hh"
+#include "feature/extrema_scan.hh"
+#include "feature/gradient.hh"
 
 mySIFT::mySIFT(Mat<float>& img, int octave, int scale, double sigma){
 	// Initial the parameters
 	this->octave = octave;
 	this->scale = scale;
-	
-	// Construct the scale space
-	this->gausPyr = generateGaussianPyramid(img, octave, scale, sigma);
-	this->DoGs = generateDoGPyramid(this->gausPyr, octave, scale, sigma);
-	//print_debug("start findkeypoints\n"); 
-	this->features = findKeypoints();
-	print_debug("find key points.\n");
-
-	delete[] DoGs;
-
-	this->mag_Pyramid = new Mat<float>[octave*(scale+3)];
-	this->ori_Pyramid = new Mat<float>[octave*(scale+3)];
-    	for(int i=0;i<octave;i++)
-    		for(int j=0;j<scale+3;j++)
-    			GetOriAndMag(i,j);
-	print_debug("getoriandmag\n");
-	int num_keypoint = features.size();
-	print_debug("number = %d\n", num_keypoint);
-    	for(int i=0;i<num_keypoint;i++)
-    	{
-    		key_point tmp = features[i];
-    		std::vector<double> oris = OrientationAssignment(tmp);
-		print_debug("num_keypoint = %d\n",i);
-		if (oris.size() == 0) continue;
-    		features[i].orientation=oris[0];
-    		for(int j=1;j<oris.size();j++)
-    		{
-    			key_point p = tmp;
-    			p.orientation = oris[j];
-    			features.push_back(p);
-    		}
-    	}
-	print_debug("number = %d\n", features.size());
-     	for(int i=0;i<features.size();i++) GetVector(features[i]);
-	
-	print_debug("find features.\n");
-	delete[] mag_Pyramid;
-	delete[] ori_Pyramid;
-	delete[] gausPyr;
+	this->Desc = FeatureSet(128);
+	const PyramidKernels& kernels = PyramidKernels::get(scale, sigma);
+	initSigma(kernels);
+
+	// The scale space is processed one octave at a time:
+	// build the gaussian layers, detect keypoints while streaming the DoG,
+	// describe the keypoints, then release the octave.
+	Mat<float> base = kernels.blur(0, convertRGBToGray(img));
+	for (int o = 0; o < octave; o++) {
+		buildOctave(base, kernels);
+		if (o + 1 < octave)
+			base = downSample(gausPyr[scale]);
+
+		size_t first = features.size();
+		findKeypoints(o);
+
+		// gradients are only computed around the keypoints
+		gradients.resize(scale);
+		for (int j = 0; j < scale; j++) {
+			gradients[j].reset(gausPyr[j]);
+			patches.push_back(&PatchTable::get(this->sigma[o * (scale + 3) + j]));
+		}
+		for (size_t i = first; i < features.size(); i++) {
+			const key_point& kp = features[i];
+			gradients[kp.scale_id].require(kp.x, kp.y, patchRadius(kp));
+		}
+		for (int j = 0; j < scale; j++)
+			gradients[j].compute();
+
+		TotalTimer tm("mySIFT descriptor");
+		// orientations of each keypoint are computed in parallel,
+		// then extra orientations are appended in keypoint order
+		int num_keypoint = features.size() - first;
+		vector<vector<double>> oris(num_keypoint);
+#pragma omp parallel
+		{
+			PatchSamples samples;
+#pragma omp for schedule(dynamic)
+			for (int i = 0; i < num_keypoint; i++) {
+				sampleOrientation(features[first + i], samples);
+				oris[i] = OrientationAssignment(samples);
+			}
+		}
+		vector<int> extra_begin(num_keypoint);	/* index of the first extra orientation */
+		for (int i = 0; i < num_keypoint; i++) {
+			extra_begin[i] = features.size();
+			if (oris[i].empty()) continue;
+			key_point& kp = features[first + i];
+			kp.orientation = oris[i][0];
+			for (size_t j = 1; j < oris[i].size(); j++) {
+				key_point p = kp;
+				p.orientation = oris[i][j];
+				features.push_back(p);
+			}
+		}
+
+		// Desc row k describes features[k].
+		// All orientations of a keypoint share the same samples
+		Desc.resize(features.size());
+#pragma omp parallel
+		{
+			PatchSamples samples;
+#pragma omp for schedule(dynamic)
+			for (int i = 0; i < num_keypoint; i++) {
+				sampleDescriptor(features[first + i], samples);
+				GetVector(first + i, samples);
+				for (size_t j = 1; j < oris[i].size(); j++)
+					GetVector(extra_begin[i] + j - 1, samples);
+			}
+		}
+
+		gausPyr.clear();
+		gradients.clear();
+		patches.clear();
+	}
+	print_debug("number of features = %lu\n", features.size());
 }
 
 Mat<float> mySIFT::convertRGBToGray(const Mat<float>& src){
 	// Determine the type of input image
-	if (src.channels() == 1){
-		cout << "The input image is a gray image." << endl;
+	if (src.channels() == 1)
 		return src;
-	}
 
 	// Initial the size of output image.
 	Mat<float> dst(src.rows(), src.cols(), 1);
 	//dst = cvCreateMat(src.rows, src.cols, CV_64F);
 
 	// Convert the image 
-	const float* srcdata = src.ptr();
-	float* dstdata = dst.ptr();
-	for(int i = 0; i < src.pixels(); i++){
-		dstdata[i] = (srcdata[i * 3 + 0] + srcdata[i * 3 + 1] + srcdata[i * 3 + 2]) / 3.0f;
+	for(int r = 0; r < src.rows(); r++){
+		const float* srcdata = src.ptr(r);
+		float* dstdata = dst.ptr(r);
+		for(int i = 0; i < src.cols(); i++)
+			dstdata[i] = (srcdata[i * 3 + 0] + srcdata[i * 3 + 1] + srcdata[i * 3 + 2]) / 3.0f;
 	}
 	return dst;
 }
@@ -88,93 +130,12 @@ Mat<float> mySIFT::convertRGBToGray(const Mat<float>& src){
 	return dst;
 }
 
-void mySIFT::convolve(const Mat<float>& src, double filter[], Mat<float>& dst, int a, int b){
-	// Initialization
-	dst = src.clone();
-	
-	// Padding
-	 
-	Mat<float> srcPadding(src.rows() + 2 * a, src.cols() + 2 * b, 1);
-/*	for(int x = 0; x < srcPadding.rows(); x++){
-		for(int y = 0; y < srcPadding.cols(); y++){
-			if(y > (src.cols() + b - 1) || x > (src.rows() + a - 1) || x <= a || y <=b)
-				srcPadding.at(x, y) = 0.0;
-			else
-				srcPadding.at(x, y) = src.at(x - a, y - b);
-		}
-	}
-*/	 
-	int filterSize = min(2 * a + 1, 2 * b + 1);
-
- /*
-	for(int x = a; x < srcPadding.rows() - a; x++){
-		for(int y = b; y < srcPadding.cols() - b; y++){
-			double sum = 0.0;
-			for(int s = -a; s <= a; s++){
-				for(int t = -b; t <= b; t++){
-					sum += filter[(s + a) * filterSize + (t + b)] * srcPadding.at(x + s, y + t);	
-				}
-			}
-			dst.at(x - a, y - b) = sum;
-		}
-	} 
-*/	 
-	
-	for(int x = a; x < src.rows() - a; x++){
- 		for(int y = b; y < src.cols() - b; y++){
- 			float sum = 0.0;
- 			for(int s = -a; s <= a; s++){
- 				for(int t = -b; t <= b; t++){
- 					sum += filter[(s + a) * filterSize + (t + b)] * src.at(x + s, y + t);
- 							
- 				}
- 			}
- 			dst.at(x , y) = sum;
- 		}
- 	}
-}
-
-void mySIFT::gaussianSmoothing(const Mat<float>& src, Mat<float>& dst, double sigma){
-	// Generate the gaussian mask
-	GaussianMask gaussianMask(sigma);
-	double* filter = gaussianMask.getFullMask();
-	int filterSize = gaussianMask.getSize();
-	Mat<float> dstCx;
-	convolve(src, filter, dstCx, filterSize / 2, 0);
-	convolve(dstCx, filter, dst, 0, filterSize / 2);
-}
-
-void mySIFT::subtraction(const Mat<float>& src1, const Mat<float>& src2, Mat<float>& dst){
-	if (src1.cols() != src2.cols() || src1.rows() != src2.rows()){
-		cout << "The sizes are not same." << endl;
-		return;
-	}
-	dst = src1.clone();
-	for (int x = 0; x < src1.rows(); x++){
-		for (int y = 0; y < src1.cols(); y++){
-//			dst.at(x,y) = ((src1.at(x,y) - src2.at(x,y)) > 0 ? (src1.at(x,y) - src2.at(x,y)) : (src2.at(x,y) - src1.at(x,y)));
-			dst.at(x,y) = src1.at(x, y) - src2.at(x,y);
-		}
-	}
-}
-
-Mat<float>* mySIFT::generateGaussianPyramid(Mat<float>& src, int octaves, int scales, double sigma){
-	double k = pow(2, (1 / (double)this->scale));
+void mySIFT::initSigma(const PyramidKernels& kernels){
 	int intervalGaus = scale + 3;
-
-	Mat<float>* gaussPyr = new Mat<float>[octaves * intervalGaus];
-
-	Mat<float> initGrayImg = convertRGBToGray(src);
-	
-	double *sigmas = new double[intervalGaus];
-	sigmas[0] = sigma;
-	for(int i = 1; i < intervalGaus; i++){
-		sigmas[i] = sigmas[i - 1] * k;
-	}
-
+	double k = pow(2, (1 / (double)scale));
 	this->sigma = new double[octave * intervalGaus];
 	for (int i = 0; i < intervalGaus; i++)
-		this->sigma[i] = sigmas[i];
+		this->sigma[i] = kernels.getSigma(i);
 	for(int i = 1 ; i < octave ; i++)
 		for (int j = 0; j < intervalGaus; j++) {
 			if (j == 0)
@@ -182,99 +143,48 @@ Mat<float>* mySIFT::generateGaussianPyramid(Mat<float>& src, int octaves, int sc
 			else
 				this->sigma[i*intervalGaus + j] = this->sigma[i*intervalGaus + j - 1] * k;
 		}
-	
-	// Generate smoothing images in the first octave
-	for (int i = 0; i < intervalGaus; i++){
-		Mat<float> smoothing;
-		if(i == 0)
-			//gaussianSmoothing(initUpSampling, smoothing, sigmas[i]);
-			gaussianSmoothing(initGrayImg, smoothing, sigmas[i]);
-		else
-			gaussianSmoothing(gaussPyr[i-1], smoothing, sigmas[i]);
-		gaussPyr[i] = smoothing;
-	}
-	// Use down sample to generate every first layer of rest octave 
-	// And then get smooth images base on it
-	 
-	for(int i = 1; i < octaves; i++){
-		//Mat<float> downSampling;
-		//downSample(gaussPyr[intervalGaus * (i - 1) + 3], downSampling);
-		gaussPyr[i * intervalGaus] = downSample(gaussPyr[intervalGaus * (i - 1) + 3]);
-		for(int j = 1; j < intervalGaus; j++){
-			Mat<float> dsmoothing;
-			gaussianSmoothing(gaussPyr[i * intervalGaus + j - 1], dsmoothing, sigmas[j]);
-			gaussPyr[i * intervalGaus + j] = dsmoothing; 
-		}
-
-	} 
-	//write_rgb("gaus16.jpg",gaussPyr[16]);
-	int n = gaussPyr[15].pixels();
-	vector<unsigned char> img(n*4);
-	const float* p = gaussPyr[15].ptr();
-	unsigned char* data = img.data();
-	REP(i,n){
-		data[0] = data[1] = data[2] = ((p[0] < 0) ? 1 : p[0]) * 255;
-		data[3] = 255;
-		data += 4;
-		p += 1;
-	}
-	unsigned error = lodepng::encode("gauss15.png",img, gaussPyr[15].width(), gaussPyr[15].height());
-	if(error)
-		error_exit(ssprintf("png encode error %u: %s", error, lodepng_error_text(error)));
-
-	return gaussPyr;
 }
 
-Mat<float>* mySIFT::generateDoGPyramid(Mat<float>* gaussPyr, int octaves, int scales, double sigma){
-	int intervalDoGs = scale + 2;
+// Each layer is blurred from the previous one with the incremental sigma.
+// base is the first layer, which is already blurred to the base sigma.
+void mySIFT::buildOctave(const Mat<float>& base, const PyramidKernels& kernels){
 	int intervalGaus = scale + 3;
-	Mat<float>* dogPyr = new Mat<float>[this->octave * intervalDoGs];
+	gausPyr.resize(intervalGaus);
+	gausPyr[0] = base;
+	for(int j = 1; j < intervalGaus; j++)
+		gausPyr[j] = kernels.blur(j, gausPyr[j - 1]);
+}
 
-	for(int i = 0; i < octaves; i++){
-		for(int j = 0; j < intervalDoGs; j++){
-			Mat<float> subImg;
-			subtraction(gaussPyr[i * intervalGaus + j + 1], gaussPyr[i * intervalGaus + j], subImg);
-			dogPyr[i * intervalDoGs + j] = subImg;
-		}
-	}
-//	write_rgb("dog13.jpg",dogPyr[13]);
-	int n = dogPyr[13].pixels();
-	vector<unsigned char> img(n*4);
-	const float* p = dogPyr[13].ptr();
-	unsigned char* data = img.data();
-	REP(i,n){
-		data[0] = data[1] = data[2] =(unsigned char)(((p[0] < 0) ? (-p[0]) : p[0]) * 2000.0) ;
-		data[3] = 255;
-		data += 4;
-		p += 1;
-	}
-	unsigned error = lodepng::encode("dog13.png",img, dogPyr[13].width(), dogPyr[13].height());
-	if(error)
-		error_exit(ssprintf("png encode error %u: %s", error, lodepng_error_text(error)));
-
-	n = dogPyr[3].pixels();
-	vector<unsigned char> img3(n*4);
-	const float* p3 = dogPyr[3].ptr();
-	unsigned char* data3 = img3.data();
-	float min = 999.0;
-	REP(i,n){
-		if(min > p3[0]) min = p3[0];
-		p3 += 1;
-	}
-	p3 = dogPyr[3].ptr();
-	REP(i,n){
-		data3[0] = data3[1] = data3[2] = (unsigned char)((p3[0] - min) * 1000.0);
-				 //=(unsigned char)(((p3[0] < 0) ? (-p3[0]) : p3[0]) * 2000.0) ;
-		data3[3] = 255;
-		data3 += 4;
-		p3 += 1;
+PyramidKernels::PyramidKernels(int scales, double sigma){
+	int intervalGaus = scales + 3;
+	double k = pow(2, (1 / (double)scales));
+	sigmas.resize(intervalGaus);
+	sigmas[0] = sigma;
+	for (int i = 1; i < intervalGaus; i++)
+		sigmas[i] = sigmas[i - 1] * k;
+
+	for (int i = 0; i < intervalGaus; i++){
+		double prev = (i == 0) ? SIFT_INIT_SIGMA : sigmas[i - 1];
+		GaussianMask mask(sqrt(max(sigmas[i] * sigmas[i] - prev * prev, 1e-4)));
+		const double* m = mask.getFullMask();
+		kernels.emplace_back(m, m + mask.getSize());
 	}
-	unsigned error3 = lodepng::encode("dog3.png",img3, dogPyr[3].width(), dogPyr[3].height());
-	if(error3)
-		error_exit(ssprintf("png encode error %u: %s", error3, lodepng_error_text(error3)));
-	
-	return dogPyr;
-	
+}
+
+const PyramidKernels& PyramidKernels::get(int scales, double sigma){
+	static std::mutex mt;
+	static std::map<std::pair<int, double>, std::unique_ptr<PyramidKernels>> cache;
+	std::lock_guard<std::mutex> lg(mt);
+	auto& ret = cache[std::make_pair(scales, sigma)];
+	if (!ret)
+		ret.reset(new PyramidKernels(scales, sigma));
+	return *ret;
+}
+
+Mat<float> PyramidKernels::blur(int level, const Mat<float>& src) const{
+	const vector<float>& kernel = kernels[level];
+	int center = kernel.size() / 2;
+	return convolve_separable(src, kernel.data() + center, center);
 }
 
 GaussianMask::GaussianMask(double sigma){
@@ -309,49 +219,63 @@ GaussianMask::GaussianMask(double sigma){
 }
 
 
-// detect features by finding extrema in DoG scale space
-vector<key_point> mySIFT::findKeypoints() {
-	vector<key_point> keyPoints;
-	for (int o = 0; o < octave; o++) {
-		for (int i = 0; i < scale; i++) {
-			for (int r = SIFT_IMG_BORDER; r < DoGs[o * (scale + 2) + i + 1].rows() - SIFT_IMG_BORDER; r++) {
-				for (int c = SIFT_IMG_BORDER; c < DoGs[o * (scale + 2) + i + 1].cols() - SIFT_IMG_BORDER; c++) {
-					if (isExtremum(o, i, r, c)) {
-						key_point kp;
-						if (interpolateExtrema(o, i, r, c, kp)) {
-							keyPoints.push_back(kp);
-						}
-					}
-				}
+// detect features by finding extrema in DoG scale space.
+// DoG layer l = gausPyr[l + 1] - gausPyr[l] is computed into a ring of 3 layers,
+// and layer l - 1 is scanned as soon as layer l is ready.
+// Rows are processed in parallel, and keypoints are merged in row order.
+void mySIFT::findKeypoints(int octave) {
+	int rows = gausPyr[0].rows(), cols = gausPyr[0].cols();
+	for (int l = 0; l < 3; l++)
+		DoGs[l] = Mat<float>(rows, cols, 1);
+	vector<vector<key_point>> found(rows);	/* keypoints of each row */
+
+	for (int l = 0; l < scale + 2; l++) {
+		Mat<float>& dog = DoGs[l % 3];
+#pragma omp parallel
+		{
+			vector<int> candidates;
+#pragma omp for schedule(static)
+			for (int r = 0; r < rows; r++) {
+				const float* p1 = gausPyr[l + 1].ptr(r);
+				const float* p0 = gausPyr[l].ptr(r);
+				float* d = dog.ptr(r);
+				for (int c = 0; c < cols; c++)
+					d[c] = p1[c] - p0[c];
+			}
+			// layer l, l - 1, l - 2 are all ready after the barrier
+			if (l >= 2) {
+#pragma omp for schedule(dynamic, 8)
+				for (int r = SIFT_IMG_BORDER; r < rows - SIFT_IMG_BORDER; r++)
+					detectRow(octave, l - 2, r, candidates, found[r]);
 			}
 		}
-	
+		for (auto& kps : found) {
+			features.insert(features.end(), kps.begin(), kps.end());
+			kps.clear();
+		}
 	}
-	return keyPoints;
+	for (int l = 0; l < 3; l++)
+		DoGs[l] = Mat<float>();
 }
 
-// check its 26 neighbors in 3x3 regions at the current and adjacent scales
-// to find out if it's an extremum
-bool mySIFT::isExtremum(int octave, int interval, int row, int column) {
-	bool maximum = true, minimum = true;
-
-	double cur_value = DoGs[octave * (this->scale + 2) + interval + 1].at(row, column);
-
-	// (for convenience the loop check include current pixel itself)
-	for (int i = interval - 1; i <= interval + 1; i++) {
-		for (int r = row - 1; r <= row + 1; r++) {
-			for (int c = column - 1; c <= column + 1; c++) {
-				// current image = DoGs[octave * (scale + 2) + i + 1]
-				if (cur_value < DoGs[octave * (scale + 2) + i + 1].at(r, c))
-					maximum = false;
-				if (cur_value > DoGs[octave * (scale + 2) + i + 1].at(r, c))
-					minimum = false;
-				if (!maximum && !minimum)
-					return false;
-			}
-		}
+// find extrema in one row of DoG layer interval + 1.
+// Candidates are collected by a vectorized scan first, then refined one by one.
+void mySIFT::detectRow(int octave, int interval, int row,
+		vector<int>& candidates, vector<key_point>& out) {
+	int cols = gausPyr[0].cols();
+	const float* rows[3][3];
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			rows[i][j] = DoGs[(interval + i) % 3].ptr(row - 1 + j);
+
+	candidates.clear();
+	scan_extrema_row(rows, SIFT_IMG_BORDER, cols - SIFT_IMG_BORDER,
+			SIFT_PRE_CONTR_THR, candidates);
+	for (int c : candidates) {
+		key_point kp;
+		if (interpolateExtrema(octave, interval, row, c, kp))
+			out.push_back(kp);
 	}
-	return true;
 }
 
 // interpolate extrema to sub-pixel accuracy
@@ -366,42 +290,42 @@ bool mySIFT::interpolateExtrema(int octave, int interval, int row, int column, k
 	double dx, dy, ds, dxx, dyy, dss, dxy, dxs, dys;
 	double offset_c, offset_r, offset_i;
 	while (i < SIFT_MAX_INTERP_STEPS) {
-		layer_index = octave * (scale + 2) + cur_interval + 1;
+		layer_index = cur_interval + 1;
 
 		// first derivative
-		dx = (DoGs[layer_index].at(cur_row, cur_col + 1) -
-			DoGs[layer_index].at(cur_row, cur_col - 1)) / 2;
-		dy = (DoGs[layer_index].at(cur_row + 1, cur_col) -
-			DoGs[layer_index].at(cur_row - 1, cur_col)) / 2;
-		ds = (DoGs[layer_index + 1].at(cur_row, cur_col) -
-			DoGs[layer_index - 1].at(cur_row, cur_col)) / 2;
+		dx = (dog(layer_index, cur_row, cur_col + 1) -
+			dog(layer_index, cur_row, cur_col - 1)) / 2;
+		dy = (dog(layer_index, cur_row + 1, cur_col) -
+			dog(layer_index, cur_row - 1, cur_col)) / 2;
+		ds = (dog(layer_index + 1, cur_row, cur_col) -
+			dog(layer_index - 1, cur_row, cur_col)) / 2;
 		//Vec3f dD(dx, dy, ds);
 		dD.at(0, 0) = dx;
 		dD.at(1, 0) = dy;
 		dD.at(2, 0) = ds;
 
 		// second partial derivative (3 * 3 hessian matrix)
-		dxx = DoGs[layer_index].at(cur_row, cur_col + 1) +
-			DoGs[layer_index].at(cur_row, cur_col - 1) -
-			DoGs[layer_index].at(cur_row, cur_col) * 2;
-		dyy = DoGs[layer_index].at(cur_row + 1, cur_col) +
-			DoGs[layer_index].at(cur_row - 1, cur_col) -
-			DoGs[layer_index].at(cur_row, cur_col) * 2;
-		dss = DoGs[layer_index + 1].at(cur_row, cur_col) +
-			DoGs[layer_index - 1].at(cur_row, cur_col) -
-			DoGs[layer_index].at(cur_row, cur_col) * 2;
-		dxy = (DoGs[layer_index].at(cur_row + 1, cur_col + 1) -
-			DoGs[layer_index].at(cur_row + 1, cur_col - 1) -
-			DoGs[layer_index].at(cur_row - 1, cur_col + 1) +
-			DoGs[layer_index].at(cur_row - 1, cur_col - 1)) / 4;
-		dxs = (DoGs[layer_index + 1].at(cur_row, cur_col + 1) -
-			DoGs[layer_index + 1].at(cur_row, cur_col - 1) -
-			DoGs[layer_index - 1].at(cur_row, cur_col + 1) +
-			DoGs[layer_index - 1].at(cur_row, cur_col - 1)) / 4;
-		dys = (DoGs[layer_index + 1].at(cur_row + 1, cur_col) -
-			DoGs[layer_index + 1].at(cur_row - 1, cur_col) -
-			DoGs[layer_index - 1].at(cur_row + 1, cur_col) +
-			DoGs[layer_index - 1].at(cur_row - 1, cur_col)) / 4;
+		dxx = dog(layer_index, cur_row, cur_col + 1) +
+			dog(layer_index, cur_row, cur_col - 1) -
+			dog(layer_index, cur_row, cur_col) * 2;
+		dyy = dog(layer_index, cur_row + 1, cur_col) +
+			dog(layer_index, cur_row - 1, cur_col) -
+			dog(layer_index, cur_row, cur_col) * 2;
+		dss = dog(layer_index + 1, cur_row, cur_col) +
+			dog(layer_index - 1, cur_row, cur_col) -
+			dog(layer_index, cur_row, cur_col) * 2;
+		dxy = (dog(layer_index, cur_row + 1, cur_col + 1) -
+			dog(layer_index, cur_row + 1, cur_col - 1) -
+			dog(layer_index, cur_row - 1, cur_col + 1) +
+			dog(layer_index, cur_row - 1, cur_col - 1)) / 4;
+		dxs = (dog(layer_index + 1, cur_row, cur_col + 1) -
+			dog(layer_index + 1, cur_row, cur_col - 1) -
+			dog(layer_index - 1, cur_row, cur_col + 1) +
+			dog(layer_index - 1, cur_row, cur_col - 1)) / 4;
+		dys = (dog(layer_index + 1, cur_row + 1, cur_col) -
+			dog(layer_index + 1, cur_row - 1, cur_col) -
+			dog(layer_index - 1, cur_row + 1, cur_col) +
+			dog(layer_index - 1, cur_row - 1, cur_col)) / 4;
 		
 		Matrix hessian(3, 3);
 		
@@ -443,8 +367,8 @@ bool mySIFT::interpolateExtrema(int octave, int interval, int row, int column, k
 		// if the point is over the border, discards it
 		if (cur_interval < 0 || cur_interval > scale - 1 ||
 			cur_col < SIFT_IMG_BORDER || cur_row < SIFT_IMG_BORDER ||
-			cur_col >= DoGs[octave * (scale + 2) + cur_interval + 1].cols() - SIFT_IMG_BORDER ||
-			cur_row >= DoGs[octave * (scale + 2) + cur_interval + 1].rows() - SIFT_IMG_BORDER)
+			cur_col >= gausPyr[0].cols() - SIFT_IMG_BORDER ||
+			cur_row >= gausPyr[0].rows() - SIFT_IMG_BORDER)
 			return false;
 
 		i++;
@@ -457,14 +381,14 @@ bool mySIFT::interpolateExtrema(int octave, int interval, int row, int column, k
 	
 	// rejecting unstable extrema with low contrast
 	// all extrema with a value of |D(x)| less than the threshold (0.03 in Lowe's paper) were discarded
-	layer_index = octave * (scale + 2) + cur_interval + 1;
+	layer_index = cur_interval + 1;
         double dot_product = dD.at(0, 0)*offset.at(0, 0)+dD.at(1, 0)*offset.at(1, 0)+dD.at(2, 0)*offset.at(2, 0);
-	double D_x = DoGs[layer_index].at(cur_row, cur_col) + dot_product / 2;
+	double D_x = dog(layer_index, cur_row, cur_col) + dot_product / 2;
 //	cout << "dot" << endl;
 	if (abs(D_x) < SIFT_CONTR_THR)
 		return false;
 	
-	if (!isEdge(octave, cur_interval, cur_row, cur_col)) {
+	if (!isEdge(cur_interval, cur_row, cur_col)) {
 		// the keypoint's actual coordinate in the image
 		double x = (cur_col + offset_c);
 		double y = (cur_row + offset_r);
@@ -478,20 +402,20 @@ bool mySIFT::interpolateExtrema(int octave, int interval, int row, int column, k
 }
 
 // eliminate edge responses
-bool mySIFT::isEdge(int octave, int interval, int row, int column) {
-	int layer_index = octave * (scale + 2) + interval + 1;
+bool mySIFT::isEdge(int interval, int row, int column) {
+	int layer_index = interval + 1;
 
 	// the principal curvatures can be computed from a 2 * 2 hessian matrix
-	double dxx = DoGs[layer_index].at(row, column + 1) +
-		DoGs[layer_index].at(row, column - 1) -
-		DoGs[layer_index].at(row, column) * 2;
-	double dyy = DoGs[layer_index].at(row + 1, column) +
-		DoGs[layer_index].at(row - 1, column) -
-		DoGs[layer_index].at(row, column) * 2;
-	double dxy = (DoGs[layer_index].at(row + 1, column + 1) -
-		DoGs[layer_index].at(row + 1, column - 1) -
-		DoGs[layer_index].at(row - 1, column + 1) +
-		DoGs[layer_index].at(row - 1, column - 1)) / 4;
+	double dxx = dog(layer_index, row, column + 1) +
+		dog(layer_index, row, column - 1) -
+		dog(layer_index, row, column) * 2;
+	double dyy = dog(layer_index, row + 1, column) +
+		dog(layer_index, row - 1, column) -
+		dog(layer_index, row, column) * 2;
+	double dxy = (dog(layer_index, row + 1, column + 1) -
+		dog(layer_index, row + 1, column - 1) -
+		dog(layer_index, row - 1, column + 1) +
+		dog(layer_index, row - 1, column - 1)) / 4;
 
 	double trace = dxx + dyy;
 	double det = dxx * dyy - dxy * dxy;
@@ -508,71 +432,143 @@ bool mySIFT::isEdge(int octave, int interval, int row, int column) {
 }
 
 
-void mySIFT::GetOriAndMag(int oct_id, int scale_id)
-{
-	double PI=3.14159265358;
-	Mat32f origin= gausPyr[oct_id*6+scale_id];
-	int w = origin.cols(); 
-	int h = origin.rows();
-	mag_Pyramid[oct_id*6+scale_id] = Mat32f(h,w,1);
-	ori_Pyramid[oct_id*6+scale_id] = Mat32f(h,w,1);
+void GradientTiles::reset(const Mat<float>& img){
+	this->img = &img;
+	tiles_x = (img.cols() + TILE - 1) / TILE;
+	tiles_y = (img.rows() + TILE - 1) / TILE;
+	tile_offset.assign(tiles_x * tiles_y, -1);
+	required.clear();
+	mag_buf.clear();
+	ori_buf.clear();
+}
 
-	Mat32f& mag = mag_Pyramid[oct_id*6+scale_id];
-	Mat32f& ori = ori_Pyramid[oct_id*6+scale_id];
+void GradientTiles::require(double x, double y, int r){
+	int x0 = max((int)x - r - 1, 0) / TILE,
+		x1 = min((int)x + r + 1, img->cols() - 1) / TILE,
+		y0 = max((int)y - r - 1, 0) / TILE,
+		y1 = min((int)y + r + 1, img->rows() - 1) / TILE;
+	for (int ty = y0; ty <= y1; ty++)
+		for (int tx = x0; tx <= x1; tx++) {
+			int id = ty * tiles_x + tx;
+			if (tile_offset[id] < 0) {
+				tile_offset[id] = required.size() * TILE * TILE;
+				required.push_back(id);
+			}
+		}
+}
 
-	for(int y=0;y<h;y++)
-	{
-		(mag.ptr(y))[0]=0;
-		(ori.ptr(y))[0]=PI;
+// gradients by central difference. border pixels have magnitude 0 and orientation pi
+void GradientTiles::compute(){
+	const float PI = 3.14159265358f;
+	int w = img->cols(), h = img->rows();
+	int n = required.size();
+	mag_buf.resize(n * TILE * TILE);
+	ori_buf.resize(n * TILE * TILE);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < n; i++) {
+		int tx = required[i] % tiles_x, ty = required[i] / tiles_x;
+		int x0 = tx * TILE, x1 = min(x0 + TILE, w),
+			y0 = ty * TILE, y1 = min(y0 + TILE, h);
+		for (int y = y0; y < y1; y++) {
+			float* mag = mag_buf.data() + i * TILE * TILE + (y - y0) * TILE - x0;
+			float* ori = ori_buf.data() + i * TILE * TILE + (y - y0) * TILE - x0;
+			int begin = max(x0, 1), end = min(x1, w - 1);
+			if (y == 0 || y == h - 1)
+				begin = end = x1;
+			if (begin < end)
+				gradient_row(img->ptr(y - 1) + begin, img->ptr(y) + begin, img->ptr(y + 1) + begin,
+						end - begin, mag + begin, ori + begin);
+			for (int x = x0; x < x1; x++)
+				if (x < begin || x >= end) {
+					mag[x] = 0;
+					ori[x] = PI;
+				}
+		}
+	}
+}
 
-		for(int x=1;x<w-1;x++)
-		{
-			if(y>0 && y<h-1)
-			{
-				double dy=(ori.ptr(y+1))[x]-(ori.ptr(y-1))[x];
-				double dx=(ori.ptr(y))[x+1]-(ori.ptr(y))[x-1];
-				(mag.ptr(y))[x] = sqrt(dx*dx+dy*dy);
-				(ori.ptr(y))[x] = (dy==0 && dx==0) ? 0:atan2(dy,dx);
-				if((ori.ptr(y))[x]<0) (ori.ptr(y))[x] += 2*PI;
+PatchTable::PatchTable(double sigma){
+	double ori_sigma = 1.5 * sigma;
+	int ori_radius = round(sigma * 4.5);
+	double bin_width = 3.0 * sigma;
+	int desc_radius = round(sqrt(0.5) * bin_width * (4 + 1));
+	inv_bin_width = 1.0 / bin_width;
+	radius = 0;
+	int r = max(ori_radius, desc_radius);
+	for (int xx = -r; xx <= r; xx++)
+		for (int yy = -r; yy <= r; yy++) {
+			int d2 = xx * xx + yy * yy;
+			if (d2 <= ori_radius * ori_radius) {
+				ori_dx.push_back(xx);
+				ori_dy.push_back(yy);
+				ori_weight.push_back(exp(-d2 / (2 * ori_sigma * ori_sigma)));
+				update_max(radius, max(abs(xx), abs(yy)));
 			}
-			else
-			{
-				(mag.ptr(y))[x]=0;
-				(ori.ptr(y))[x]=PI;
+			// the descriptor window is narrow, most samples in its circle have no weight
+			double w = exp(-d2 / 8.0);
+			if (d2 <= desc_radius * desc_radius && w >= SIFT_DESC_WEIGHT_EPS) {
+				desc_dx.push_back(xx);
+				desc_dy.push_back(yy);
+				desc_weight.push_back(w);
+				update_max(radius, max(abs(xx), abs(yy)));
 			}
 		}
+}
 
-		(mag.ptr(y))[w-1]=0;
-		(ori.ptr(y))[w-1]=PI;
+const PatchTable& PatchTable::get(double sigma){
+	static std::mutex mt;
+	static std::map<double, std::unique_ptr<PatchTable>> cache;
+	std::lock_guard<std::mutex> lg(mt);
+	auto& ret = cache[sigma];
+	if (!ret)
+		ret.reset(new PatchTable(sigma));
+	return *ret;
+}
+
+// gradients in the orientation patch around p, skipping the image border
+void mySIFT::sampleOrientation(const key_point& p, PatchSamples& s) const
+{
+	const PatchTable& t = *patches[p.scale_id];
+	const GradientTiles& grad = gradients[p.scale_id];
+	int w = grad.cols(), h = grad.rows();
+	int px = p.x, py = p.y;
+	s.ori.clear(); s.ori_mag.clear();
+	for (size_t k = 0; k < t.ori_dx.size(); k++) {
+		int x = px + t.ori_dx[k], y = py + t.ori_dy[k];
+		if (x <= 0 || x >= w - 1 || y <= 0 || y >= h - 1) continue;
+		s.ori.push_back(grad.ori(y, x));
+		s.ori_mag.push_back(grad.mag(y, x) * t.ori_weight[k]);
 	}
 }
 
+// gradients in the descriptor patch around p, skipping the image border
+void mySIFT::sampleDescriptor(const key_point& p, PatchSamples& s) const
+{
+	const PatchTable& t = *patches[p.scale_id];
+	const GradientTiles& grad = gradients[p.scale_id];
+	int w = grad.cols(), h = grad.rows();
+	int px = p.x, py = p.y;
+	s.dx.clear(); s.dy.clear(); s.desc_ori.clear(); s.desc_mag.clear();
+	for (size_t k = 0; k < t.desc_dx.size(); k++) {
+		int x = px + t.desc_dx[k], y = py + t.desc_dy[k];
+		if (x <= 0 || x >= w - 1 || y <= 0 || y >= h - 1) continue;
+		s.dx.push_back(t.desc_dx[k]);
+		s.dy.push_back(t.desc_dy[k]);
+		s.desc_ori.push_back(grad.ori(y, x));
+		s.desc_mag.push_back(grad.mag(y, x) * t.desc_weight[k]);
+	}
+}
 
-std::vector<double> mySIFT::OrientationAssignment(key_point p)
+std::vector<double> mySIFT::OrientationAssignment(const PatchSamples& s) const
 {
-	Mat32f& ori_img=ori_Pyramid[p.oct_id*6+p.scale_id];
-	Mat32f& mag_img=mag_Pyramid[p.oct_id*6+p.scale_id];
 	double PI=3.14159265358;
-	int r=round(this->sigma[p.oct_id*6+p.scale_id] *4.5);
+	float hist_f[37] = {0};	// bin 36 is the same as bin 0
+	const float bins_per_rad = 18 / PI;
+	for (size_t k = 0; k < s.ori.size(); k++)
+		hist_f[(int)(s.ori[k] * bins_per_rad + 0.5f)] += s.ori_mag[k];
 	double hist[36];
-	for(int i=0;i<36;i++) hist[i]=0;
-
-	for(int xx=-r;xx<=r;xx++)
-	{
-		int x=p.x+xx;
-		if(x<=0 || x>=ori_img.cols()-1) continue;
-		for(int yy=-r;yy<=r;yy++)
-		{
-			int y=p.y+yy;
-			if(y<=0 || y>=ori_img.rows()-1) continue;
-			if(sqr(xx)+sqr(yy)>sqr(r)) continue;
-			double ori=ori_img.at(y,x);
-			int bin=round(ori/PI*180.0/10.0);
-			if (bin==36) bin=0;
-			hist[bin]+=mag_img.at(y,x)*exp( -(sqr(xx)+sqr(yy)) / (2*sqr(1.5*this->sigma[p.oct_id * 6 + p.scale_id])) );
-
-		}
-	}
+	for(int i=0;i<36;i++) hist[i]=hist_f[i];
+	hist[0]+=hist_f[36];
 
 	for(int i=0;i<2;i++)
 	{
@@ -617,55 +613,63 @@ std::vector<double> mySIFT::OrientationAssignment(key_point p)
 }
 
 
-void mySIFT::GetVector(key_point p)
+// rotate the samples to the keypoint orientation,
+// and accumulate them into 4x4 spatial bins of 8 orientation bins with trilinear interpolation
+// writes row k of Desc, which describes features[k]
+void mySIFT::GetVector(int k, PatchSamples& s)
 {
-	double PI=3.14159265358;
-	Mat32f& mag_img=mag_Pyramid[p.oct_id*6+p.scale_id];
-	Mat32f& ori_img=ori_Pyramid[p.oct_id*6+p.scale_id];
-	int w=ori_img.cols(), h=ori_img.rows();
-
-	double ori=p.orientation;
-	int r= round(sqrt(0.5)*3*this->sigma[p.oct_id * 6 + p.scale_id]*(4+1));
-	double hist[16][8];
-	for(int i=0;i<16;i++)
-		for(int j=0;j<8;j++)
-			hist[i][j]=0;
-
-	double cos_part= cos(ori), sin_part= sin(ori);
-
-	for(int xx=-r;xx<=r;xx++)
-	{
-		int x=p.x+xx;
-		if(x<=0 || x>=w-1) continue;
-		for(int yy=-r;yy<=r;yy++)
-		{
-			int y=p.y+yy;
-			if(y<=0 || y>=h-1) continue;
-			if(sqr(xx)+sqr(yy)>sqr(r)) continue;
-
-			double bin_y = (-xx*sin_part+yy*cos_part)/(3.0*this->sigma[p.oct_id * 6 + p.scale_id])+1.5;
-			double bin_x = (xx*cos_part +yy*sin_part)/(3.0*this->sigma[p.oct_id * 6 + p.scale_id])+1.5;
-
-			if(bin_y<-1 || bin_y>=4 || bin_x<-1 || bin_x>=4) continue;
-
-			double ori_loc = ori_img.at(y,x);
-			double mag_loc = mag_img.at(y,x);
-			double w_mag = mag_loc * exp( -(sqr(xx)+sqr(yy)) / 8 );
-			double r_ori = ori_loc -  ori;
-
-			if(r_ori<0) r_ori += 2*PI;
+	const float PI = 3.14159265358f;
+	const key_point& p = features[k];
+	double ori = p.orientation;
+	const GradientTiles& grad = gradients[p.scale_id];
+	int n = s.dx.size();
+	float cos_part = cos(ori) * patches[p.scale_id]->inv_bin_width,
+		  sin_part = sin(ori) * patches[p.scale_id]->inv_bin_width;
+	float ori_f = ori;
+	const float bins_per_rad = 4 / PI;
+
+	// independent per sample, and vectorized by the compiler
+	s.bin_x.resize(n); s.bin_y.resize(n); s.bin_o.resize(n);
+	float *bin_x = s.bin_x.data(), *bin_y = s.bin_y.data(), *bin_o = s.bin_o.data();
+	const float *dx = s.dx.data(), *dy = s.dy.data(), *sori = s.desc_ori.data();
+	for (int t = 0; t < n; t++) {
+		bin_x[t] = dx[t] * cos_part + dy[t] * sin_part + 1.5f;
+		bin_y[t] = dy[t] * cos_part - dx[t] * sin_part + 1.5f;
+		float r = sori[t] - ori_f;
+		bin_o[t] = (r < 0 ? r + 2 * PI : r) * bins_per_rad;
+	}
 
-			double bin_hist = r_ori /PI * 180.0 /45.0;
-			TriInterpolation(bin_x,bin_y,bin_hist,w_mag,hist);
+	// spatial bins are padded by one on each side to skip the bound checks.
+	// orientation bin 8 and 9 are folded into 0 and 1.
+	float hist[6][6][10];
+	memset(hist, 0, sizeof(hist));
+	for (int t = 0; t < n; t++) {
+		float x = bin_x[t], y = bin_y[t], o = bin_o[t];
+		if (y < -1 || y >= 4 || x < -1 || x >= 4) continue;
+		int xf = floor(x), yf = floor(y), of = o;
+		float delta_x = x - xf, delta_y = y - yf, delta_o = o - of;
+		float w_mag = s.desc_mag[t];
+		for (int i = 0; i < 2; i++) {
+			float wy = w_mag * (i ? delta_y : 1 - delta_y);
+			for (int j = 0; j < 2; j++) {
+				float wx = wy * (j ? delta_x : 1 - delta_x);
+				float* h = hist[yf + 1 + i][xf + 1 + j];
+				h[of] += wx * (1 - delta_o);
+				h[of + 1] += wx * delta_o;
+			}
 		}
 	}
-	std::vector<float> result(128);
-	for(int i=0;i<16;i++)
-		for(int j=0;j<8;j++)
-			result[8*i+j]=hist[i][j];
 
-	double sum=0;
-	for(int i=0;i<128;i++) sum+=sqr(result[i]);
+	float* result = Desc.descriptor(k);
+	for(int i=0;i<4;i++)
+		for(int j=0;j<4;j++) {
+			float* h = hist[i + 1][j + 1];
+			for (int o=0;o<8;o++)
+				result[8*(4*i+j)+o] = h[o] + (o < 2 ? h[o + 8] : 0);
+		}
+
+	float sum=0;
+	for(int i=0;i<128;i++) sum+=result[i]*result[i];
 	sum=sqrt(sum);
 	for(int i=0;i<128;i++)
 	{
@@ -673,49 +677,10 @@ void mySIFT::GetVector(key_point p)
 		if(result[i]>0.2) result[i]=0.2;
 	}
 	sum=0;
-	for(int i=0;i<128;i++) sum+=sqr(result[i]);
+	for(int i=0;i<128;i++) sum+=result[i]*result[i];
 	sum=sqrt(sum);
 	for(int i=0;i<128;i++) result[i]/=sum;
 
-	Descriptor d;
-	d.descriptor=result;
-	d.coor.x= p.x/w;
-	d.coor.y= p.y/h;
-
-	Desc.emplace_back(move(d));
-}
-
-
-void mySIFT::TriInterpolation(double x, double y, double h, double w_mag, double hist[][8])
-{
-	int xf=floor(x),
-	    yf=floor(y),
-	    hf=floor(h);
-
-	double delta_x = x-xf,
-	       delta_y = y-yf,
-	       delta_h = h-hf;
-
-	for(int i=0;i<2;i++)
-	{
-		if((yf+i)>=0 && (yf+i)<4)
-		{
-			double wy = w_mag * (i? delta_y : 1-delta_y);
-			for(int j=0;j<2;j++)
-			{
-				if((xf+j)>=0 && (xf+j)<4)
-				{
-					double wx = wy * (j? delta_x : 1-delta_x);
-					hist[4*(yf+i)+(xf+j)][hf % 8] += wx * (1-delta_h);
-					hist[4*(yf+i)+(xf+j)][(hf+1) % 8] += wx * delta_h;
-				}
-			}
-		}
-	}
-}
-
-double mySIFT::sqr(double a)
-{
-	return a*a;
+	Desc.coor[k].x= p.x/grad.cols();
+	Desc.coor[k].y= p.y/grad.rows();
 }
-
@@ -22,6 +22,8 @@ using namespace pano;
 
 /* Recommended sigma */
 #define SIGMA 1.6f
+/* Assumed blur of the input image */
+#define SIFT_INIT_SIGMA 0.5f
 /* Recommended scale spaces */
 #define INTERVALS 3
 
@@ -31,8 +33,14 @@ using namespace pano;
 
 #define SIFT_CONTR_THR 0.0005f
 
+/* Extrema with |D| below this are rejected before the 26-neighbour test */
+#define SIFT_PRE_CONTR_THR (0.5f * SIFT_CONTR_THR)
+
 #define SIFT_CURV_THR 10.f
 
+/* Descriptor samples with a smaller gaussian weight are skipped */
+#define SIFT_DESC_WEIGHT_EPS 1e-7
+
 /* Data struct of key point */
 typedef struct key_points{
 	double x;
@@ -44,47 +52,118 @@ typedef struct key_points{
 }key_point;
 
 
+/* Gaussian kernels to build one octave, shared by all images with the same parameters.
+   Layer i is blurred from layer i-1 by sqrt(sigma_i^2 - sigma_{i-1}^2). */
+class PyramidKernels{
+	private:
+		vector<double> sigmas;  /* absolute sigma of each layer */
+		vector<vector<float>> kernels;  /* kernels[0] blurs the input image to sigmas[0] */
+	public:
+		PyramidKernels(int scales, double sigma);
+		static const PyramidKernels& get(int scales, double sigma);
+		Mat<float> blur(int level, const Mat<float>& src) const;
+		double getSigma(int level) const { return sigmas[level]; }
+};
+
+/* Gradient magnitude and orientation of one gaussian layer.
+   Only the tiles covered by keypoint patches are computed,
+   and a tile shared by overlapping patches is computed once. */
+class GradientTiles{
+	private:
+		static const int TILE = 16;
+		const Mat<float>* img = nullptr;
+		int tiles_x = 0, tiles_y = 0;
+		vector<int> tile_offset;  /* offset of each tile in mag_buf / ori_buf, -1 if not required */
+		vector<int> required;  /* ids of the required tiles */
+		vector<float> mag_buf, ori_buf;
+	public:
+		void reset(const Mat<float>& img);
+		/* require the gradients of the square patch of radius r around (x, y) */
+		void require(double x, double y, int r);
+		/* compute all required tiles */
+		void compute();
+		int cols() const { return img->cols(); }
+		int rows() const { return img->rows(); }
+		float mag(int y, int x) const { return mag_buf[index(y, x)]; }
+		/* in [0, 2 * pi) */
+		float ori(int y, int x) const { return ori_buf[index(y, x)]; }
+	protected:
+		int index(int y, int x) const {
+			int off = tile_offset[(y / TILE) * tiles_x + x / TILE];
+			m_assert(off >= 0);
+			return off + (y % TILE) * TILE + x % TILE;
+		}
+};
+
+/* Sample offsets and gaussian weights of the patches around a keypoint in one layer.
+   Shared by all keypoints of the layers with the same sigma, in all images. */
+class PatchTable{
+	public:
+		int radius;  /* of the square containing all samples */
+		float inv_bin_width;  /* 1 / width of a descriptor bin, in pixels */
+		vector<int> ori_dx, ori_dy;  /* samples of the orientation histogram */
+		vector<float> ori_weight;
+		vector<int> desc_dx, desc_dy;  /* samples of the descriptor */
+		vector<float> desc_weight;
+
+		PatchTable(double sigma);
+		static const PatchTable& get(double sigma);
+};
+
+/* Gradients sampled around a keypoint, shared by all of its orientations. */
+struct PatchSamples{
+	vector<float> ori, ori_mag;  /* orientation samples, with weighted magnitude */
+	vector<float> dx, dy, desc_ori, desc_mag;  /* descriptor samples */
+	vector<float> bin_x, bin_y, bin_o;  /* scratch for one orientation */
+};
+
 /* SITF features of an image.*/
 
 class mySIFT{
 	private:
-		Mat<float>* DoGs; /* 1D array of DoG Pyramid */
-		Mat<float>* gausPyr;  /* 1D array of Gaussian Pyramid */
 		int octave;  /* number of octaves */
 		int scale; 
 		//double sigma; 
 		vector<key_point> features;
-		Mat<float>* mag_Pyramid;
-		Mat<float>* ori_Pyramid;
 		double* sigma;
-		std::vector<Descriptor> Desc;
+		FeatureSet Desc;  /* row k describes features[k] */
+
+		/* Scale space of the octave being processed.
+		   Octaves are built one at a time and released before the next one. */
+		vector<Mat<float>> gausPyr;  /* scale + 3 gaussian layers */
+		Mat<float> DoGs[3];  /* ring buffer of DoG layers, layer l is in DoGs[l % 3] */
+		vector<GradientTiles> gradients;  /* of the first scale gaussian layers */
+		vector<const PatchTable*> patches;  /* of the first scale gaussian layers */
 
 	public:
 		mySIFT(Mat<float>& img, int octave, int scale, double sigma);
 		~mySIFT(){delete[] sigma;} 
-		std::vector<Descriptor> GetDescriptor() { return Desc; }
+		FeatureSet& GetDescriptor() { return Desc; }
 		vector<key_point> get_extrema() {return features; }
 
 	protected:
 		Mat<float> convertRGBToGray(const Mat<float>& src);
 		//void upSample(const Mat<float>& src, Mat<float>& dst); 
 		Mat<float> downSample(const Mat<float>& src);
-		void convolve(const Mat<float>& src, double filter[], Mat<float>& dst, int a, int b);
-		void gaussianSmoothing(const Mat<float>& src, Mat<float>& dst, double sigma);
-		void subtraction(const Mat<float>& src1, const Mat<float>& src2, Mat<float>& dst);
-		Mat<float>* generateGaussianPyramid(Mat<float>& src, int octaves, int scales, double sigma);
-		Mat<float>* generateDoGPyramid(Mat<float>* gaussPyr, int octaves, int scales, double sigma);
-		
-		vector<key_point> findKeypoints();
-		bool isExtremum(int octave, int interval, int row, int column);
-		bool interpolateExtrema(int octave, int interval, int row, int column, key_point& kp);
-		bool isEdge(int octave, int interval, int row, int column);	
+		void initSigma(const PyramidKernels& kernels);
+		void buildOctave(const Mat<float>& base, const PyramidKernels& kernels);
 
-		void GetOriAndMag(int oct_id, int scale_id);
-		std::vector<double> OrientationAssignment(key_point p);
-		void GetVector(key_point p);
-		void TriInterpolation(double x, double y, double h, double w_mag, double hist[][8]);
-		double sqr(double a);
+		void findKeypoints(int octave);
+		void detectRow(int octave, int interval, int row,
+				vector<int>& candidates, vector<key_point>& out);
+		bool interpolateExtrema(int octave, int interval, int row, int column, key_point& kp);
+		bool isEdge(int interval, int row, int column);	
+		/* value of DoG layer l in the current octave */
+		float dog(int l, int row, int column) const {
+			return gausPyr[l + 1].at(row, column) - gausPyr[l].at(row, column);
+		}
+
+		/* radius of the patch read by OrientationAssignment and GetVector */
+		int patchRadius(const key_point& p) const { return patches[p.scale_id]->radius; }
+		void sampleOrientation(const key_point& p, PatchSamples& s) const;
+		void sampleDescriptor(const key_point& p, PatchSamples& s) const;
+		std::vector<double> OrientationAssignment(const PatchSamples& s) const;
+		void GetVector(int k, PatchSamples& s);
 
 };
 
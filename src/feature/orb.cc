@@ -0,0 +1,227 @@
+//File: orb.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "orb.hh"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "lib/config.hh"
+#include "lib/convolve.hh"
+#include "lib/debugutils.hh"
+#include "lib/imgproc.hh"
+#include "lib/timer.hh"
+#include "lib/utils.hh"
+
+using namespace std;
+using namespace config;
+
+namespace {
+
+// the 16 pixels on the bresenham circle of radius 3, in order
+const int FAST_CIRCLE[16][2] = {
+	{0, -3}, {1, -3}, {2, -2}, {3, -1}, {3, 0}, {3, 1}, {2, 2}, {1, 3},
+	{0, 3}, {-1, 3}, {-2, 2}, {-3, 1}, {-3, 0}, {-3, -1}, {-2, -2}, {-1, -3}};
+
+const int HALF_PATCH = ORB_PATCH_SIZE / 2;
+// rotated tests stay in the circle of radius HALF_PATCH * sqrt(2)
+const int BORDER = HALF_PATCH * 1.4143 + 1;
+
+// whether the 16-bit mask has 9 contiguous bits on the circle
+inline bool has_arc(unsigned mask) {
+	mask |= mask << 16;
+	unsigned m = mask;
+	REP(i, 8)
+		m &= mask >> (i + 1);
+	return m != 0;
+}
+
+}
+
+namespace pano {
+
+ORB::ORB(const Mat32f& img, const ORBPattern& pattern):
+	img(img), pattern(pattern) { m_assert(img.channels() == 1); }
+
+vector<ORB::Keypoint> ORB::detect(const Mat32f& level) const {
+	const int w = level.width(), h = level.height();
+	int offset[16];
+	REP(i, 16)
+		offset[i] = FAST_CIRCLE[i][1] * level.stride() + FAST_CIRCLE[i][0];
+
+	// harris response of FAST corners, 0 elsewhere
+	vector<float> score(w * h, 0);
+#pragma omp parallel for schedule(dynamic)
+	REPL(y, BORDER, h - BORDER) {
+		const float* row = level.ptr(y);
+		float* srow = score.data() + y * w;
+		REPL(x, BORDER, w - BORDER) {
+			const float* p = row + x;
+			const float hi = *p + ORB_FAST_THRES, lo = *p - ORB_FAST_THRES;
+			// any arc of 9 covers at least two of the four compass points
+			int nr_hi = (p[offset[0]] > hi) + (p[offset[4]] > hi) + (p[offset[8]] > hi) + (p[offset[12]] > hi),
+					nr_lo = (p[offset[0]] < lo) + (p[offset[4]] < lo) + (p[offset[8]] < lo) + (p[offset[12]] < lo);
+			if (nr_hi < 2 && nr_lo < 2)
+				continue;
+			unsigned mask_hi = 0, mask_lo = 0;
+			REP(i, 16) {
+				float v = p[offset[i]];
+				mask_hi |= (unsigned)(v > hi) << i;
+				mask_lo |= (unsigned)(v < lo) << i;
+			}
+			if (has_arc(mask_hi) || has_arc(mask_lo))
+				srow[x] = max(harris(level, x, y), numeric_limits<float>::min());
+		}
+	}
+
+	vector<Keypoint> ret;
+	REPL(y, BORDER, h - BORDER) REPL(x, BORDER, w - BORDER) {
+		const float* s = score.data() + y * w + x;
+		if (*s <= 0)
+			continue;
+		if (*s < s[-1] || *s <= s[1] ||
+				*s < s[-w - 1] || *s < s[-w] || *s < s[-w + 1] ||
+				*s <= s[w - 1] || *s <= s[w] || *s <= s[w + 1])
+			continue;
+		ret.push_back(Keypoint{x, y, *s, 0});
+	}
+	return ret;
+}
+
+// harris response in a 7x7 window, using sobel gradients
+float ORB::harris(const Mat32f& level, int x, int y) const {
+	const int r = 3;
+	const float k = 0.04f;
+	float a = 0, b = 0, c = 0;
+	REPL(dy, -r, r + 1) {
+		const float *p0 = level.ptr(y + dy - 1) + x,
+					*p1 = level.ptr(y + dy) + x,
+					*p2 = level.ptr(y + dy + 1) + x;
+		REPL(dx, -r, r + 1) {
+			float ix = (p0[dx + 1] - p0[dx - 1]) + 2 * (p1[dx + 1] - p1[dx - 1]) + (p2[dx + 1] - p2[dx - 1]),
+						iy = (p2[dx - 1] + 2 * p2[dx] + p2[dx + 1]) - (p0[dx - 1] + 2 * p0[dx] + p0[dx + 1]);
+			a += ix * ix, b += iy * iy, c += ix * iy;
+		}
+	}
+	return a * b - c * c - k * sqr(a + b);
+}
+
+float ORB::orientation(const Mat32f& level, int x, int y) const {
+	// half width of each row in the circle
+	static const vector<int> umax = [] {
+		vector<int> ret(HALF_PATCH + 1);
+		REP(v, HALF_PATCH + 1)
+			ret[v] = floor(sqrt(sqr(HALF_PATCH + 0.5) - sqr(v)));
+		return ret;
+	}();
+	float m01 = 0, m10 = 0;
+	REPL(v, -HALF_PATCH, HALF_PATCH + 1) {
+		const float* p = level.ptr(y + v) + x;
+		const int d = umax[abs(v)];
+		float sum = 0;
+		REPL(u, -d, d + 1) {
+			m10 += u * p[u];
+			sum += p[u];
+		}
+		m01 += v * sum;
+	}
+	return atan2(m01, m10);
+}
+
+void ORB::calc_descriptor(const Mat32f& smoothed, const Keypoint& p, uint64_t* desc) const {
+	const float c = cos(p.dir), s = sin(p.dir);
+	auto pixel = [&](int x, int y) {
+		int rx = round(c * x - s * y), ry = round(s * x + c * y);
+		return smoothed.at(p.y + ry, p.x + rx);
+	};
+	REP(i, pattern.pattern.size()) {
+		auto& t = pattern.pattern[i];
+		if (pixel(t.x1, t.y1) < pixel(t.x2, t.y2))
+			desc[i / 64] |= 1ULL << (i % 64);
+	}
+}
+
+FeatureSet ORB::get_descriptor() const {
+	TotalTimer tm("orb");
+	// 5x5 gaussian with sigma 2 to smooth the tests
+	const int center = 2;
+	float kernel_buf[center * 2 + 1];
+	float* kernel = kernel_buf + center, sum = 0;
+	REPL(i, -center, center + 1)
+		sum += (kernel[i] = exp(-sqr(i) / 8.f));
+	REPL(i, -center, center + 1)
+		kernel[i] /= sum;
+
+	vector<Mat32f> levels{img};
+	vector<float> scales{1};
+	float total_area = img.pixels();
+	REPL(l, 1, ORB_NR_LEVEL) {
+		int w = img.width() / scales.back() / ORB_SCALE_FACTOR,
+				h = img.height() / scales.back() / ORB_SCALE_FACTOR;
+		if (min(w, h) <= BORDER * 2 + 1)
+			break;
+		Mat32f next(h, w, 1);
+		resize(levels.back(), next);
+		levels.emplace_back(move(next));
+		scales.push_back(scales.back() * ORB_SCALE_FACTOR);
+		total_area += levels.back().pixels();
+	}
+
+	FeatureSet ret(pattern.pattern.size(), ORB_NR_FEATURE, FeatureSet::Type::BINARY);
+	REP(l, levels.size()) {
+		const Mat32f& level = levels[l];
+		auto keyp = detect(level);
+		// features are distributed to levels by area, the strongest ones are kept
+		size_t nr_keep = ORB_NR_FEATURE * (level.pixels() / total_area);
+		if (keyp.size() > nr_keep) {
+			nth_element(keyp.begin(), keyp.begin() + nr_keep, keyp.end(),
+					[](const Keypoint& a, const Keypoint& b) { return a.score > b.score; });
+			keyp.resize(nr_keep);
+		}
+
+		Mat32f smoothed = convolve_separable(level, kernel, center);
+		const int start = ret.size();
+		const float scale = scales[l];
+		ret.resize(start + keyp.size());
+#pragma omp parallel for schedule(dynamic)
+		REP(k, (int)keyp.size()) {
+			auto& p = keyp[k];
+			p.dir = orientation(level, p.x, p.y);
+			calc_descriptor(smoothed, p, ret.bdescriptor(start + k));
+			// inverse of the bilinear resize
+			ret.coor[start + k] = Vec2D(
+					((p.x + 0.5) * scale - 0.5) / img.width(),
+					((p.y + 0.5) * scale - 0.5) / img.height());
+		}
+	}
+	return ret;
+}
+
+// gaussian samples in the patch like BRIEF, with a fixed seed
+// so that descriptors of all images are comparable
+ORBPattern ORB::gen_orb_pattern(int n) {
+	m_assert(n % 64 == 0);
+	mt19937 randgen(n);
+	normal_distribution<> d(0, ORB_PATCH_SIZE / 5.0);
+	auto get_sample = [&]() {
+		int ret;
+		do {
+			ret = round(d(randgen));
+		} while (abs(ret) > HALF_PATCH - 2);
+		return ret;
+	};
+
+	ORBPattern ret;
+	while (n--) {
+		ORBPattern::Test t;
+		do {
+			t.x1 = get_sample(), t.y1 = get_sample();
+			t.x2 = get_sample(), t.y2 = get_sample();
+		} while (t.x1 == t.x2 && t.y1 == t.y2);
+		ret.pattern.push_back(t);
+	}
+	return ret;
+}
+
+}
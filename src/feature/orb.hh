@@ -0,0 +1,54 @@
+//File: orb.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <vector>
+#include "feature.hh"
+
+// ORB: Oriented FAST and Rotated BRIEF
+
+namespace pano {
+
+struct ORBPattern {
+	// offsets of the two points of each test, around the keypoint
+	struct Test { int x1, y1, x2, y2; };
+	std::vector<Test> pattern;
+};
+
+// ORB algorithm implementation
+class ORB {
+	public:
+		// img: grey image at working resolution
+		ORB(const Mat32f& img, const ORBPattern&);
+		ORB(const ORB&) = delete;
+		ORB& operator = (const ORB&) = delete;
+
+		// return [0, 1] coordinates, and binary descriptors
+		FeatureSet get_descriptor() const;
+
+		// n: number of tests. the pattern is fixed for a given n
+		static ORBPattern gen_orb_pattern(int n);
+
+	protected:
+		struct Keypoint {
+			int x, y;			// in the pyramid level
+			float score;	// harris response
+			float dir;
+		};
+
+		const Mat32f& img;
+		const ORBPattern& pattern;
+
+		// FAST corners of one level, after non-maximum suppression by harris response
+		std::vector<Keypoint> detect(const Mat32f& level) const;
+
+		float harris(const Mat32f& level, int x, int y) const;
+
+		// direction of the intensity centroid
+		float orientation(const Mat32f& level, int x, int y) const;
+
+		// smoothed: the level blurred to remove noise of single pixels
+		void calc_descriptor(const Mat32f& smoothed, const Keypoint&, uint64_t* desc) const;
+};
+
+}
@@ -0,0 +1,139 @@
+//File: retrieval.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "retrieval.hh"
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <flann/flann.hpp>
+
+#include "lib/config.hh"
+#include "lib/debugutils.hh"
+#include "lib/timer.hh"
+#include "lib/utils.hh"
+
+using namespace std;
+using namespace config;
+
+namespace pano {
+
+ImageRetrieval::ImageRetrieval(const vector<FeatureSet>& feats):
+	feats(feats) {
+	TotalTimer tm("image retrieval");
+	const int nimg = feats.size(), D = feats.at(0).dim();
+	vector<float> centers = build_vocabulary();
+	nr_word_ = centers.size() / D;
+
+	flann::Index<flann::L2<float>> index(
+			flann::Matrix<float>(centers.data(), nr_word_, D),
+			flann::KDTreeIndexParams(FLANN_NR_KDTREE));
+	index.buildIndex();
+
+	// term frequency of each image
+	bow.resize(nimg);
+	vector<int> df(nr_word_, 0);
+#pragma omp parallel for schedule(dynamic)
+	REP(k, nimg) {
+		auto& feat = feats[k];
+		const int n = feat.size();
+		vector<float> query((size_t)n * D);
+		REP(i, n)
+			to_float(feat, i, query.data() + (size_t)i * D);
+		vector<int> words(n);
+		vector<float> dists(n);
+		flann::Matrix<int> indices(words.data(), n, 1);
+		flann::Matrix<float> dists_mat(dists.data(), n, 1);
+		index.knnSearch(flann::Matrix<float>(query.data(), n, D),
+				indices, dists_mat, 1, flann::SearchParams(32));
+
+		auto& v = bow[k];
+		v.assign(nr_word_, 0);
+		for (int w : words)
+			if (w >= 0)
+				v[w] += 1.f / n;
+#pragma omp critical
+		REP(w, nr_word_)
+			df[w] += v[w] > 0;
+	}
+
+	// weight by inverse document frequency, and normalize for cosine similarity
+	for (auto& v : bow) {
+		float norm = 0;
+		REP(w, nr_word_) {
+			if (df[w])
+				v[w] *= log((float)nimg / df[w]);
+			norm += sqr(v[w]);
+		}
+		if (norm > 0) {
+			norm = 1.f / sqrt(norm);
+			for (auto& x : v)
+				x *= norm;
+		}
+	}
+	print_debug("Built vocabulary of %d words for %d images\n", nr_word_, nimg);
+}
+
+vector<float> ImageRetrieval::build_vocabulary() const {
+	const int D = feats[0].dim();
+	vector<float> samples;
+	int nr_sample = 0;
+	for (auto& feat : feats) {
+		// evenly spaced, to be deterministic
+		int step = max(feat.size() / RETRIEVAL_NR_SAMPLE, 1);
+		for (int i = 0; i < feat.size(); i += step) {
+			samples.resize((size_t)(nr_sample + 1) * D);
+			to_float(feat, i, samples.data() + (size_t)nr_sample * D);
+			nr_sample ++;
+		}
+	}
+	m_assert(nr_sample > 0);
+	int nr_word = min(RETRIEVAL_NR_WORD, nr_sample);
+	vector<float> centers((size_t)nr_word * D);
+	flann::Matrix<float> centers_mat(centers.data(), nr_word, D);
+	nr_word = flann::hierarchicalClustering<flann::L2<float>>(
+			flann::Matrix<float>(samples.data(), nr_sample, D), centers_mat,
+			flann::KMeansIndexParams(RETRIEVAL_BRANCHING, 11));
+	centers.resize((size_t)nr_word * D);
+	return centers;
+}
+
+void ImageRetrieval::to_float(const FeatureSet& feat, int i, float* out) const {
+	const int D = feat.dim();
+	if (feat.binary()) {
+		const uint64_t* p = feat.bdescriptor(i);
+		REP(d, D)
+			out[d] = (p[d / 64] >> (d % 64)) & 1;
+	} else if (feat.quantized()) {
+		const uint8_t* p = feat.qdescriptor(i);
+		REP(d, D)
+			out[d] = p[d];
+	} else
+		memcpy(out, feat.descriptor(i), D * sizeof(float));
+}
+
+float ImageRetrieval::similarity(int i, int j) const {
+	float ret = 0;
+	REP(w, nr_word_)
+		ret += bow[i][w] * bow[j][w];
+	return ret;
+}
+
+vector<pair<int, int>> ImageRetrieval::shortlist(int k) const {
+	const int n = bow.size();
+	set<pair<int, int>> ret;
+	REP(i, n) {
+		vector<pair<float, int>> sims;
+		REP(j, n) if (j != i)
+			sims.emplace_back(similarity(i, j), j);
+		int nr_keep = min(k, (int)sims.size());
+		partial_sort(sims.begin(), sims.begin() + nr_keep, sims.end(),
+				[](const pair<float, int>& a, const pair<float, int>& b) { return a.first > b.first; });
+		REP(t, nr_keep) {
+			int j = sims[t].second;
+			ret.emplace(min(i, j), max(i, j));
+		}
+	}
+	return vector<pair<int, int>>(ret.begin(), ret.end());
+}
+
+}
@@ -0,0 +1,42 @@
+//File: retrieval.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <utility>
+#include <vector>
+#include "feature.hh"
+
+namespace pano {
+
+// Find similar images by bag-of-words, to avoid matching all pairs of images.
+// A vocabulary is built by hierarchical k-means on descriptors sampled from all images,
+// and each image is described by the tf-idf weighted histogram of its visual words.
+class ImageRetrieval {
+	public:
+		explicit ImageRetrieval(const std::vector<FeatureSet>& feats);
+
+		ImageRetrieval(const ImageRetrieval&) = delete;
+		ImageRetrieval& operator = (const ImageRetrieval&) = delete;
+
+		// cosine similarity of the tf-idf vectors of two images
+		float similarity(int i, int j) const;
+
+		// pairs <i, j> with i < j, where one is among the k most similar images of the other
+		std::vector<std::pair<int, int>> shortlist(int k) const;
+
+		int nr_word() const { return nr_word_; }
+
+	protected:
+		const std::vector<FeatureSet>& feats;
+		int nr_word_;
+		// normalized tf-idf vector of each image
+		std::vector<std::vector<float>> bow;
+
+		// k-means on a sample of descriptors, in float
+		std::vector<float> build_vocabulary() const;
+
+		// row i of the feature as a float vector. bits of binary descriptors become 0/1
+		void to_float(const FeatureSet& feat, int i, float* out) const;
+};
+
+}
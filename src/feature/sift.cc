@@ -12,10 +12,9 @@ using namespace pano;
 namespace {
 const int featlen = DESC_HIST_WIDTH * DESC_HIST_WIDTH * DESC_HIST_BIN_NUM;
 
-Descriptor hist_to_descriptor(float* hist) {
-	Descriptor ret;
-	ret.descriptor.resize(featlen);
-	memcpy(ret.descriptor.data(), hist, featlen * sizeof(float));
+void hist_to_descriptor(const float* hist, float* desc) {
+	memcpy(desc, hist, featlen * sizeof(float));
+	float* end = desc + featlen;
   float sum = 0;
 
 	// normalize and thresholding and renormalize
@@ -37,12 +36,10 @@ Descriptor hist_to_descriptor(float* hist) {
 	// using RootSIFT: rootsift= sqrt( sift / sum(sift) );
 	// L1 normalize SIFT
 	sum = 0;
-	for (auto &i : ret.descriptor) sum += i;
-	for (auto &i : ret.descriptor) i /= sum;
+	for (float* i = desc; i < end; ++i) sum += *i;
+	for (float* i = desc; i < end; ++i) *i /= sum;
 	// square root each element
-	for (auto &i : ret.descriptor) i = std::sqrt(i) * DESC_INT_FACTOR;
-
-	return ret;
+	for (float* i = desc; i < end; ++i) *i = std::sqrt(*i) * DESC_INT_FACTOR;
 }
 
 void trilinear_interpolate(
@@ -74,17 +71,15 @@ SIFT::SIFT(const ScaleSpace& ss,
 	ss(ss), points(keypoints)
 { }
 
-std::vector<Descriptor> SIFT::get_descriptor() const {
+FeatureSet SIFT::get_descriptor() const {
 	TotalTimer tm("sift descriptor");
-	vector<Descriptor> ret;
-	for (auto& p : points) {
-		auto desp = calc_descriptor(p);
-		ret.emplace_back(move(desp));
-	}
+	FeatureSet ret(featlen, points.size());
+	for (auto& p : points)
+		calc_descriptor(p, ret.add(p.real_coor));
 	return ret;
 }
 
-Descriptor SIFT::calc_descriptor(const SSPoint& p) const {
+void SIFT::calc_descriptor(const SSPoint& p, float* desc) const {
 	const static float pi2 = 2 * M_PI;
 	const static float nbin_per_rad = DESC_HIST_BIN_NUM / pi2;
 
@@ -146,9 +141,7 @@ Descriptor SIFT::calc_descriptor(const SSPoint& p) const {
 
 	// build descriptor from hist
 
-	Descriptor ret = hist_to_descriptor((float*)hist);
-	ret.coor = p.real_coor;
-	return ret;
+	hist_to_descriptor((float*)hist, desc);
 }
 
 }
@@ -16,13 +16,13 @@ class SIFT {
 		SIFT(const SIFT&) = delete;
 		SIFT& operator = (const SIFT&) = delete;
 
-		std::vector<Descriptor> get_descriptor() const;
+		FeatureSet get_descriptor() const;
 
 	protected:
 		const ScaleSpace& ss;
 		const std::vector<SSPoint>& points;
 
-		Descriptor calc_descriptor(const SSPoint&) const;
+		void calc_descriptor(const SSPoint&, float* desc) const;
 };
 
 }
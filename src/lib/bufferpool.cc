@@ -0,0 +1,193 @@
+//File: bufferpool.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "bufferpool.hh"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "debugutils.hh"
+
+using namespace std;
+
+namespace {
+
+using namespace pano::buffer_pool;
+
+// smaller buffers are cheap to get from malloc
+const size_t MIN_POOLED = 64 * 1024;
+// bytes kept in the free lists of all threads
+const size_t MAX_CACHED = 256 * 1024 * 1024;
+
+atomic<size_t> cached{0};
+atomic<long> nr_request{0}, nr_hit{0};
+atomic<long long> bytes_reused{0};
+
+void* aligned_alloc_bytes(size_t bytes) {
+	void* p;
+#ifdef _MSC_VER
+	p = _aligned_malloc(bytes, ALIGN);
+	if (! p)
+#else
+	if (posix_memalign(&p, ALIGN, bytes))
+#endif
+		throw bad_alloc();
+	return p;
+}
+
+void aligned_free(void* p) {
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+// classes are 2^k and 1.5 * 2^k, to waste at most 1/3
+size_t size_class(size_t bytes) {
+	size_t c = MIN_POOLED;
+	while (c < bytes) {
+		if (c + c / 2 >= bytes)
+			return c + c / 2;
+		c *= 2;
+	}
+	return c;
+}
+
+struct Arena;
+
+// all arenas, to be trimmed from any thread
+mutex& registry_mutex() {
+	static mutex mt;
+	return mt;
+}
+
+set<Arena*>& registry() {
+	static set<Arena*> arenas;
+	return arenas;
+}
+
+struct Arena {
+	// only contended by trim()
+	mutex mt;
+	unordered_map<size_t, vector<void*>> free_list;
+
+	Arena() {
+		lock_guard<mutex> lg(registry_mutex());
+		registry().insert(this);
+	}
+
+	~Arena() {
+		{
+			lock_guard<mutex> lg(registry_mutex());
+			registry().erase(this);
+		}
+		clear();
+	}
+
+	void clear() {
+		lock_guard<mutex> lg(mt);
+		for (auto& itr : free_list) {
+			for (void* p : itr.second)
+				aligned_free(p);
+			cached -= itr.first * itr.second.size();
+		}
+		free_list.clear();
+	}
+};
+
+// a trivial thread_local, so it's still accessible while other thread_locals are destroyed
+Arena*& arena_ptr() {
+	thread_local Arena* arena = nullptr;
+	return arena;
+}
+
+struct ArenaGuard {
+	~ArenaGuard() {
+		delete arena_ptr();
+		arena_ptr() = nullptr;
+	}
+};
+
+thread_local int scope_depth = 0;
+
+Arena* get_arena() {
+	Arena*& arena = arena_ptr();
+	if (! arena) {
+		thread_local ArenaGuard guard;
+		(void)guard;
+		arena = new Arena;
+	}
+	return arena;
+}
+
+}
+
+namespace pano {
+namespace buffer_pool {
+
+Scope::Scope() { scope_depth ++; }
+
+Scope::~Scope() { scope_depth --; }
+
+bool enabled() { return scope_depth > 0; }
+
+void* alloc(size_t bytes) {
+	if (bytes < MIN_POOLED)
+		return aligned_alloc_bytes(max<size_t>(bytes, 1));
+	size_t cls = size_class(bytes);
+	nr_request ++;
+	void* ret = nullptr;
+	{
+		Arena* arena = get_arena();
+		lock_guard<mutex> lg(arena->mt);
+		auto& list = arena->free_list[cls];
+		if (! list.empty()) {
+			ret = list.back();
+			list.pop_back();
+		}
+	}
+	if (! ret)
+		return aligned_alloc_bytes(cls);
+	cached -= cls;
+	nr_hit ++;
+	bytes_reused += cls;
+	return ret;
+}
+
+void free(void* p, size_t bytes) {
+	if (! p) return;
+	Arena* arena = arena_ptr();
+	size_t cls = size_class(bytes);
+	// the arena is gone when a buffer is released during thread exit
+	if (bytes < MIN_POOLED || ! arena) {
+		aligned_free(p);
+		return;
+	}
+	if (cached.fetch_add(cls) + cls > MAX_CACHED) {
+		cached -= cls;
+		aligned_free(p);
+		return;
+	}
+	lock_guard<mutex> lg(arena->mt);
+	arena->free_list[cls].push_back(p);
+}
+
+void trim() {
+	lock_guard<mutex> lg(registry_mutex());
+	for (Arena* arena : registry())
+		arena->clear();
+}
+
+void print_stats() {
+	long req = nr_request;
+	if (! req) return;
+	print_debug("buffer pool: %ld hits in %ld allocations (%.1lf%%), %.1lf MB reused.\n",
+			(long)nr_hit, req, nr_hit * 100.0 / req, bytes_reused / 1048576.0);
+}
+
+}
+}
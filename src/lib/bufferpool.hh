@@ -0,0 +1,45 @@
+//File: bufferpool.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <cstddef>
+
+namespace pano {
+
+// A pool of large buffers, to reuse the memory of the pyramids and scratch images of
+// feature detection, instead of getting fresh pages from the system for every image.
+// Buffers are rounded up to size classes and kept in a free list per thread,
+// so workers don't contend with each other. The lists of all threads are bounded together.
+// Small buffers bypass the pool.
+namespace buffer_pool {
+
+const size_t ALIGN = 64;
+
+// Mat buffers of trivial types, allocated by this thread while a Scope is alive,
+// come from the pool. Other buffers, e.g. the images to blend, are never pooled
+class Scope {
+	public:
+		Scope();
+		~Scope();
+		Scope(const Scope&) = delete;
+		Scope& operator = (const Scope&) = delete;
+};
+
+// whether this thread is in a Scope
+bool enabled();
+
+// return a buffer of at least bytes, aligned to ALIGN
+void* alloc(size_t bytes);
+
+// bytes: the size passed to alloc
+void free(void* p, size_t bytes);
+
+// return the cached buffers of all threads to the system
+void trim();
+
+// print the hit rate
+void print_stats();
+
+}
+
+}
@@ -43,10 +43,16 @@ bool STRAIGHTEN;
 int MAX_OUTPUT_SIZE;
 bool ORDERED_INPUT;
 bool LAZY_READ;
+int FEATURE_MEMORY_BUDGET;
+bool FEATURE_CACHE;
 
 int MULTIPASS_BA;
 float LM_LAMBDA;
 
+int FEATURE_DETECTOR;
+int ORB_NR_FEATURE;
+float ORB_FAST_THRES;
+
 int SIFT_WORKING_SIZE;
 int NUM_OCTAVE;
 int NUM_SCALE;
@@ -69,13 +75,26 @@ int ORI_HIST_SMOOTH_COUNT;
 
 int DESC_HIST_SCALE_FACTOR;
 int DESC_INT_FACTOR;
+bool DESC_QUANTIZE;
 
 float MATCH_REJECT_NEXT_RATIO;
+int MATCH_TOP_K;
+int MATCH_GLOBAL_K;
+int BRUTE_FORCE_MATCH_MAX_FEATURE;
+int FLANN_INDEX;
+int FLANN_NR_KDTREE;
+int FLANN_BRANCHING;
+int FLANN_KMEANS_ITERATIONS;
+float FLANN_KMEANS_CB_INDEX;
+int FLANN_CHECKS;
+float FLANN_TARGET_RECALL;
 
 int RANSAC_ITERATIONS;
 double RANSAC_INLIER_THRES;
 float INLIER_IN_MATCH_RATIO;
 float INLIER_IN_POINTS_RATIO;
+bool GUIDED_MATCH;
+float GUIDED_MATCH_RADIUS;
 
 float SLOPE_PLAIN;
 
@@ -30,6 +30,12 @@ extern bool STRAIGHTEN;
 extern int MAX_OUTPUT_SIZE;
 extern bool ORDERED_INPUT;
 extern bool LAZY_READ;
+extern int FEATURE_MEMORY_BUDGET;
+extern bool FEATURE_CACHE;
+
+extern int FEATURE_DETECTOR;
+extern int ORB_NR_FEATURE;
+extern float ORB_FAST_THRES;
 
 extern int SIFT_WORKING_SIZE;
 extern int NUM_OCTAVE;
@@ -52,13 +58,26 @@ extern int ORI_HIST_SMOOTH_COUNT;
 
 extern int DESC_HIST_SCALE_FACTOR;
 extern int DESC_INT_FACTOR;
+extern bool DESC_QUANTIZE;
 
 extern float MATCH_REJECT_NEXT_RATIO;
+extern int MATCH_TOP_K;
+extern int MATCH_GLOBAL_K;
+extern int BRUTE_FORCE_MATCH_MAX_FEATURE;
+extern int FLANN_INDEX;
+extern int FLANN_NR_KDTREE;
+extern int FLANN_BRANCHING;
+extern int FLANN_KMEANS_ITERATIONS;
+extern float FLANN_KMEANS_CB_INDEX;
+extern int FLANN_CHECKS;
+extern float FLANN_TARGET_RECALL;
 
 extern int RANSAC_ITERATIONS;
 extern double RANSAC_INLIER_THRES;
 extern float INLIER_IN_MATCH_RATIO;
 extern float INLIER_IN_POINTS_RATIO;
+extern bool GUIDED_MATCH;
+extern float GUIDED_MATCH_RADIUS;
 
 extern float SLOPE_PLAIN;
 
@@ -82,6 +101,19 @@ const float DESC_NORM_THRESH = 0.2f;
 const int BRIEF_PATH_SIZE = 9;
 const int BRIEF_NR_PAIR = 256;
 
-const int FLANN_NR_KDTREE = 6;
+const int ORB_NR_LEVEL = 4;
+const float ORB_SCALE_FACTOR = 1.3f;
+const int ORB_PATCH_SIZE = 31;
+const int ORB_NR_PAIR = 256;
+
+const char* const FEATURE_CACHE_DIR = "feature_cache";
+
+const int RETRIEVAL_NR_WORD = 1000;		// size of the vocabulary
+const int RETRIEVAL_NR_SAMPLE = 300;	// descriptors of each image used to build the vocabulary
+const int RETRIEVAL_BRANCHING = 10;
+
+const int FLANN_LSH_NR_TABLE = 12;
+const int FLANN_LSH_KEY_SIZE = 20;
+const int FLANN_LSH_MULTI_PROBE = 2;
 
 }
@@ -0,0 +1,179 @@
+//File: convolve.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "convolve.hh"
+
+#include <algorithm>
+#include <vector>
+#include "lib/simd.hh"
+#include "lib/utils.hh"
+#include "lib/debugutils.hh"
+using namespace std;
+
+namespace {
+
+using namespace pano;
+
+// working set budget of one column strip, in bytes
+const int STRIP_BUDGET = 256 * 1024;
+
+// out[x] = sum_k kernel[k] * taps[k][x], for k in [-center, center]
+// both kernel and taps are centered, and kernel is symmetric.
+typedef void (*SymFIRFunc)(
+		const float* const* taps, const float* kernel, int center,
+		float* out, int n);
+
+inline void sym_fir_range(
+		const float* const* taps, const float* kernel, int center,
+		float* out, int begin, int end) {
+	for (int x = begin; x < end; ++x) {
+		float s = kernel[0] * taps[0][x];
+		for (int k = 1; k <= center; ++k)
+			s += kernel[k] * (taps[k][x] + taps[-k][x]);
+		out[x] = s;
+	}
+}
+
+void sym_fir_scalar(
+		const float* const* taps, const float* kernel, int center,
+		float* out, int n) {
+	sym_fir_range(taps, kernel, center, out, 0, n);
+}
+
+#ifdef PANO_SIMD_DISPATCH
+
+PANO_TARGET("sse2")
+void sym_fir_sse2(
+		const float* const* taps, const float* kernel, int center,
+		float* out, int n) {
+	const __m128 k0 = _mm_set1_ps(kernel[0]);
+	int x = 0;
+	for (; x + 8 <= n; x += 8) {
+		__m128 acc0 = _mm_mul_ps(k0, _mm_loadu_ps(taps[0] + x)),
+					 acc1 = _mm_mul_ps(k0, _mm_loadu_ps(taps[0] + x + 4));
+		for (int k = 1; k <= center; ++k) {
+			const __m128 kk = _mm_set1_ps(kernel[k]);
+			const float *p = taps[k] + x, *q = taps[-k] + x;
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(kk,
+						_mm_add_ps(_mm_loadu_ps(p), _mm_loadu_ps(q))));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(kk,
+						_mm_add_ps(_mm_loadu_ps(p + 4), _mm_loadu_ps(q + 4))));
+		}
+		_mm_storeu_ps(out + x, acc0);
+		_mm_storeu_ps(out + x + 4, acc1);
+	}
+	sym_fir_range(taps, kernel, center, out, x, n);
+}
+
+PANO_TARGET("avx2,fma")
+void sym_fir_avx2(
+		const float* const* taps, const float* kernel, int center,
+		float* out, int n) {
+	const __m256 k0 = _mm256_set1_ps(kernel[0]);
+	int x = 0;
+	for (; x + 16 <= n; x += 16) {
+		__m256 acc0 = _mm256_mul_ps(k0, _mm256_loadu_ps(taps[0] + x)),
+					 acc1 = _mm256_mul_ps(k0, _mm256_loadu_ps(taps[0] + x + 8));
+		for (int k = 1; k <= center; ++k) {
+			const __m256 kk = _mm256_set1_ps(kernel[k]);
+			const float *p = taps[k] + x, *q = taps[-k] + x;
+			acc0 = _mm256_fmadd_ps(kk,
+					_mm256_add_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(q)), acc0);
+			acc1 = _mm256_fmadd_ps(kk,
+					_mm256_add_ps(_mm256_loadu_ps(p + 8), _mm256_loadu_ps(q + 8)), acc1);
+		}
+		_mm256_storeu_ps(out + x, acc0);
+		_mm256_storeu_ps(out + x + 8, acc1);
+	}
+	for (; x + 8 <= n; x += 8) {
+		__m256 acc = _mm256_mul_ps(k0, _mm256_loadu_ps(taps[0] + x));
+		for (int k = 1; k <= center; ++k)
+			acc = _mm256_fmadd_ps(_mm256_set1_ps(kernel[k]),
+					_mm256_add_ps(_mm256_loadu_ps(taps[k] + x), _mm256_loadu_ps(taps[-k] + x)),
+					acc);
+		_mm256_storeu_ps(out + x, acc);
+	}
+	sym_fir_range(taps, kernel, center, out, x, n);
+}
+
+#endif
+
+SymFIRFunc select_sym_fir() {
+#ifdef PANO_SIMD_DISPATCH
+	switch (simd_level()) {
+		case SIMDLevel::AVX512:
+		case SIMDLevel::AVX2:
+			return sym_fir_avx2;
+		case SIMDLevel::SSE2:
+			return sym_fir_sse2;
+		default:
+			break;
+	}
+#endif
+	return sym_fir_scalar;
+}
+
+}	// namespace
+
+namespace pano {
+
+void convolve_separable(
+		const float* src, int src_stride,
+		float* dst, int dst_stride,
+		int w, int h, int ch,
+		const float* kernel, int center) {
+	m_assert(src != dst);
+	m_assert(w > 0 && h > 0 && ch > 0 && center >= 0);
+	static const SymFIRFunc fir = select_sym_fir();
+
+	const int nring = center * 2 + 1;
+	int strip_w = max(32, STRIP_BUDGET / (int)(sizeof(float) * ch * (nring + 1)));
+	update_min(strip_w, w);
+	const int slot = strip_w * ch;
+	const size_t pixel_bytes = ch * sizeof(float);
+
+	vector<float> line((strip_w + center * 2) * ch);
+	vector<float> ring(nring * slot);
+	vector<const float*> taps_buf(nring);
+	const float** taps = taps_buf.data() + center;
+
+	for (int x0 = 0; x0 < w; x0 += strip_w) {
+		const int x1 = min(x0 + strip_w, w);
+		const int n = (x1 - x0) * ch;
+		const int lo = max(x0 - center, 0),
+					hi = min(x1 + center, w);
+
+		// horizontal pass of row r, into its slot in the ring
+		auto filter_row = [&](int r) {
+			const float* srow = src + (size_t)r * src_stride;
+			float* lp = line.data();
+			// line[0] corresponds to column x0 - center. replicate the border.
+			for (int x = x0 - center; x < lo; ++x, lp += ch)
+				memcpy(lp, srow, pixel_bytes);
+			memcpy(lp, srow + lo * ch, (hi - lo) * pixel_bytes);
+			lp += (hi - lo) * ch;
+			for (int x = hi; x < x1 + center; ++x, lp += ch)
+				memcpy(lp, srow + (w - 1) * ch, pixel_bytes);
+
+			const float* lc = line.data() + center * ch;
+			for (int k = -center; k <= center; ++k)
+				taps[k] = lc + k * ch;
+			fir(taps, kernel, center, ring.data() + (r % nring) * slot, n);
+		};
+
+		// vertical pass, streaming over the rows
+		int next_row = 0;
+		REP(i, h) {
+			int last = min(i + center, h - 1);
+			while (next_row <= last)
+				filter_row(next_row++);
+			for (int k = -center; k <= center; ++k) {
+				int r = max(min(i + k, h - 1), 0);
+				taps[k] = ring.data() + (r % nring) * slot;
+			}
+			fir(taps, kernel, center, dst + (size_t)i * dst_stride + x0 * ch, n);
+		}
+	}
+}
+
+}
@@ -0,0 +1,32 @@
+//File: convolve.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include "mat.h"
+
+namespace pano {
+
+// Separable convolution with a symmetric kernel, on an interleaved float image.
+// kernel points to the center tap, i.e. kernel[-center] ... kernel[center] are valid.
+// Border pixels are replicated.
+// The image is processed in column strips, and each strip streams through
+// a ring buffer of 2 * center + 1 horizontally-filtered rows,
+// so the working set stays in cache regardless of the image size.
+// src and dst must not overlap.
+// src_stride, dst_stride: number of floats between the starts of two rows
+void convolve_separable(
+		const float* src, int src_stride,
+		float* dst, int dst_stride,
+		int w, int h, int ch,
+		const float* kernel, int center);
+
+inline Mat32f convolve_separable(
+		const Mat32f& img, const float* kernel, int center) {
+	Mat32f ret(img.height(), img.width(), img.channels());
+	convolve_separable(img.ptr(), img.stride(), ret.ptr(), ret.stride(),
+			img.width(), img.height(), img.channels(),
+			kernel, center);
+	return ret;
+}
+
+}
@@ -1,8 +1,13 @@
 //File: imgio.cc
 //Author: Yuxin Wu <ppwwyyxx@gmail.com>
 
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <type_traits>
 #include <vector>
+#include <strings.h>
+#include <jpeglib.h>
 #define cimg_display 0
 #define cimg_use_jpeg
 #include "CImg.h"
@@ -17,16 +22,17 @@ using namespace std;
 namespace {
 
 void write_png(const char* fname, const Mat32f& mat) {
-	int n = mat.pixels();
-	vector<unsigned char> img(n * 4);
-	const float* p = mat.ptr();
+	vector<unsigned char> img(mat.pixels() * 4);
 	unsigned char* data = img.data();
-	REP(i, n) {
-		data[0] = (p[0] < 0 ? 1 : p[0]) * 255;
-		data[1] = (p[1] < 0 ? 1 : p[1]) * 255;
-		data[2] = (p[2] < 0 ? 1 : p[2]) * 255;
-		data[3] = 255;
-		data += 4; p += 3;
+	REP(i, mat.rows()) {
+		const float* p = mat.ptr(i);
+		REP(j, mat.cols()) {
+			data[0] = (p[0] < 0 ? 1 : p[0]) * 255;
+			data[1] = (p[1] < 0 ? 1 : p[1]) * 255;
+			data[2] = (p[2] < 0 ? 1 : p[2]) * 255;
+			data[3] = 255;
+			data += 4; p += 3;
+		}
 	}
 	unsigned error = lodepng::encode(fname, img, mat.width(), mat.height());
 	if(error)
@@ -34,58 +40,182 @@ void write_png(const char* fname, const Mat32f& mat) {
 					"png encoder error %u: %s", error, lodepng_error_text(error)));
 }
 
-Mat32f read_png(const char* fname) {
+void jpeg_error_exit(j_common_ptr cinfo) {
+	char buf[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, buf);
+	error_exit(ssprintf("libjpeg error: %s", buf));
+}
+
+bool is_jpeg(const char* fname) {
+	const char* ext = strrchr(fname, '.');
+	return ext && (! strcasecmp(ext, ".jpg") || ! strcasecmp(ext, ".jpeg"));
+}
+
+// convert decoded 8-bit samples to the element type of Mat
+inline void cvt_row(const unsigned char* src, unsigned char* dst, int n)
+{ memcpy(dst, src, n); }
+inline void cvt_row(const unsigned char* src, float* dst, int n)
+{ REP(i, n) dst[i] = src[i] / 255.0f; }
+
+// expand grey samples to rgb
+template <typename T>
+void cvt_grey_row(const unsigned char* src, T* dst, int n) {
+	REP(i, n) {
+		cvt_row(src + i, dst, 1);
+		dst[1] = dst[2] = dst[0];
+		dst += 3;
+	}
+}
+
+struct JpegDecoder {
+	FILE* fin;
+	jpeg_decompress_struct cinfo;
+	jpeg_error_mgr jerr;
+
+	explicit JpegDecoder(const char* fname) {
+		fin = fopen(fname, "rb");
+		if (! fin)
+			error_exit(ssprintf("Cannot open %s", fname));
+		cinfo.err = jpeg_std_error(&jerr);
+		jerr.error_exit = jpeg_error_exit;
+		jpeg_create_decompress(&cinfo);
+		jpeg_stdio_src(&cinfo, fin);
+		jpeg_read_header(&cinfo, TRUE);
+	}
+
+	~JpegDecoder() {
+		jpeg_destroy_decompress(&cinfo);
+		fclose(fin);
+	}
+};
+
+// decode scanlines into an interleaved rgb Mat, without a planar intermediate
+template <typename T>
+Mat<T> read_jpeg(const char* fname) {
+	JpegDecoder dec(fname);
+	auto& cinfo = dec.cinfo;
+	const bool grey = cinfo.num_components == 1;
+	cinfo.out_color_space = grey ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	const int w = cinfo.output_width;
+	Mat<T> ret(cinfo.output_height, w, 3);
+	vector<JSAMPLE> row;
+	if (grey || ! std::is_same<T, unsigned char>::value)
+		row.resize(w * cinfo.output_components);
+	while (cinfo.output_scanline < cinfo.output_height) {
+		T* dst = ret.ptr(cinfo.output_scanline);
+		// rgb bytes are decoded in place
+		JSAMPROW rowp = row.empty() ? reinterpret_cast<JSAMPROW>(dst) : row.data();
+		jpeg_read_scanlines(&cinfo, &rowp, 1);
+		if (grey)
+			cvt_grey_row(row.data(), dst, w);
+		else if (! row.empty())
+			cvt_row(row.data(), dst, w * 3);
+	}
+	jpeg_finish_decompress(&cinfo);
+	return ret;
+}
+
+template <typename T>
+Mat<T> read_png(const char* fname) {
 	vector<unsigned char> img;
 	unsigned w, h;
-	unsigned error = lodepng::decode(img, w, h, fname);
+	unsigned error = lodepng::decode(img, w, h, fname, LCT_RGB, 8);
 	if (error)
 		error_exit(ssprintf(
-					"png encoder error %u: %s", error, lodepng_error_text(error)));
-	Mat32f mat(h, w, 3);
-	unsigned npixel = w * h;
-	float* p = mat.ptr();
-	unsigned char* data = img.data();
-	REP(i, npixel) {
-		*(p++) = (float)*(data++) / 255.0;
-		*(p++) = (float)*(data++) / 255.0;
-		*(p++) = (float)*(data++) / 255.0;
-		data++;	// rgba
-	}
+					"png decoder error %u: %s", error, lodepng_error_text(error)));
+	Mat<T> mat(h, w, 3);
+	REP(i, h)
+		cvt_row(img.data() + i * w * 3, mat.ptr(i), w * 3);
 	return mat;
 }
 
-}	// namespace
-
-namespace pano {
-
-Mat32f read_img(const char* fname) {
-	if (! exists_file(fname))
-		error_exit(ssprintf("File \"%s\" not exists!", fname));
-	if (endswith(fname, ".png"))
-		return read_png(fname);
+// other formats
+template <typename T>
+Mat<T> read_cimg(const char* fname) {
 	CImg<unsigned char> img(fname);
 	m_assert(img.spectrum() == 3 || img.spectrum() == 1);
-	Mat32f mat(img.height(), img.width(), 3);
-	if (img.spectrum() == 3) {
-		REP(i, mat.rows())
-			REP(j, mat.cols()) {
-				mat.at(i, j, 0) = (float)img(j, i, 0) / 255.0;
-				mat.at(i, j, 1) = (float)img(j, i, 1) / 255.0;
-				mat.at(i, j, 2) = (float)img(j, i, 2) / 255.0;
-			}
-	} else {
-		REP(i, mat.rows())
-			REP(j, mat.cols()) {
-				mat.at(i, j, 0) = mat.at(i, j, 1) = mat.at(i, j, 2) = img(j, i);
+	Mat<T> mat(img.height(), img.width(), 3);
+	const int w = mat.width();
+	vector<unsigned char> row(w * 3);
+	REP(i, mat.rows()) {
+		T* dst = mat.ptr(i);
+		if (img.spectrum() == 3) {
+			const unsigned char *r = img.data(0, i, 0, 0), *g = img.data(0, i, 0, 1), *b = img.data(0, i, 0, 2);
+			REP(j, w) {
+				row[j * 3] = r[j];
+				row[j * 3 + 1] = g[j];
+				row[j * 3 + 2] = b[j];
 			}
+			cvt_row(row.data(), dst, w * 3);
+		} else
+			cvt_grey_row(img.data(0, i), dst, w);
 	}
+	return mat;
+}
+
+template <typename T>
+Mat<T> read_img_impl(const char* fname) {
+	if (! exists_file(fname))
+		error_exit(ssprintf("File \"%s\" not exists!", fname));
+	Mat<T> mat;
+	if (is_jpeg(fname))
+		mat = read_jpeg<T>(fname);
+	else if (endswith(fname, ".png"))
+		mat = read_png<T>(fname);
+	else
+		mat = read_cimg<T>(fname);
 	m_assert(mat.rows() > 1 && mat.cols() > 1);
 	return mat;
 }
 
-// TODO a hack for the moment
-Matuc read_img_uc(const char* fname) {
-	return cvt_f2uc(read_img(fname));
+// decode only the luma, scaled by libjpeg in the DCT domain
+Mat32f read_jpeg_grey(const char* fname, int min_size, int& width, int& height) {
+	JpegDecoder dec(fname);
+	auto& cinfo = dec.cinfo;
+	width = cinfo.image_width, height = cinfo.image_height;
+
+	int denom = 1;
+	while (denom < 8 && (width + height) / 2 / (denom * 2) >= min_size)
+		denom *= 2;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = JCS_GRAYSCALE;
+	jpeg_start_decompress(&cinfo);
+
+	Mat32f ret(cinfo.output_height, cinfo.output_width, 1);
+	vector<JSAMPLE> row(cinfo.output_width);
+	JSAMPROW rowp = row.data();
+	while (cinfo.output_scanline < cinfo.output_height) {
+		float* dst = ret.ptr(cinfo.output_scanline);
+		jpeg_read_scanlines(&cinfo, &rowp, 1);
+		REP(i, row.size())
+			dst[i] = row[i] / 255.0f;
+	}
+	jpeg_finish_decompress(&cinfo);
+	m_assert(ret.rows() > 1 && ret.cols() > 1);
+	return ret;
+}
+
+}	// namespace
+
+namespace pano {
+
+Mat32f read_img(const char* fname)
+{ return read_img_impl<float>(fname); }
+
+Matuc read_img_uc(const char* fname)
+{ return read_img_impl<unsigned char>(fname); }
+
+Mat32f read_img_grey(const char* fname, int min_size, int& width, int& height) {
+	if (! exists_file(fname))
+		error_exit(ssprintf("File \"%s\" not exists!", fname));
+	if (is_jpeg(fname))
+		return read_jpeg_grey(fname, min_size, width, height);
+	Mat32f ret = rgb2grey(read_img(fname));
+	width = ret.width(), height = ret.height();
+	return ret;
 }
 
 
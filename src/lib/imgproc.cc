@@ -180,11 +180,12 @@ Color interpolate(const Matuc& mat, float r, float c) {
 }
 
 void fill(Mat32f& mat, const Color& c) {
-	float* ptr = mat.ptr();
-	int n = mat.pixels();
-	REP(i, n) {
-		c.write_to(ptr);
-		ptr += 3;
+	REP(i, mat.rows()) {
+		float* ptr = mat.ptr(i);
+		REP(j, mat.cols()) {
+			c.write_to(ptr);
+			ptr += 3;
+		}
 	}
 }
 
@@ -215,26 +216,17 @@ Mat32f crop(const Mat32f& mat) {
 			if (update_max(maxarea, (right[k] - left[k] + 1) * height[k]))
 				ll = left[k], rr = right[k], hh = height[k], nl = line;
 	}
-	Mat32f ret(hh, rr - ll + 1, 3);
-	int offsetx = ll, offsety = nl - hh + 1;
-	REP(i, ret.height()) {
-		float* dst = ret.ptr(i, 0);
-		const float* src = mat.ptr(i + offsety, offsetx);
-		memcpy(dst, src, 3 * ret.width() * sizeof(float));
-	}
-	return ret;
+	return mat.roi(nl - hh + 1, ll, hh, rr - ll + 1);
 }
 
 Mat32f rgb2grey(const Mat32f& mat) {
 	m_assert(mat.channels() == 3);
 	Mat32f ret(mat.height(), mat.width(), 1);
-	const float* src = mat.ptr();
-	float* dst = ret.ptr();
-	int n = mat.pixels();
-	int idx = 0;
-	for (int i = 0; i < n; ++i) {
-		dst[i] = (src[idx] + src[idx+1] + src[idx+2]) / 3.f;
-		idx += 3;
+	REP(r, mat.rows()) {
+		const float* src = mat.ptr(r);
+		float* dst = ret.ptr(r);
+		REP(i, mat.cols())
+			dst[i] = (src[i * 3] + src[i * 3 + 1] + src[i * 3 + 2]) / 3.f;
 	}
 	return ret;
 }
@@ -319,11 +311,24 @@ void resize<float>(const Mat32f &src, Mat32f &dst) {
 Matuc cvt_f2uc(const Mat32f& mat) {
 	m_assert(mat.channels() == 3);
 	Matuc ret(mat.rows(), mat.cols(), 3);
-	auto ps = mat.ptr();
-	auto pt = ret.ptr();
-	int n = mat.pixels() * 3;
-	REP(i, n)
-		*(pt++) = *(ps++) * 255.0;
+	REP(r, mat.rows()) {
+		auto ps = mat.ptr(r);
+		auto pt = ret.ptr(r);
+		REP(i, mat.cols() * 3)
+			*(pt++) = *(ps++) * 255.0;
+	}
+	return ret;
+}
+
+Mat32f cvt_uc2f(const Matuc& mat) {
+	m_assert(mat.channels() == 3);
+	Mat32f ret(mat.rows(), mat.cols(), 3);
+	REP(r, mat.rows()) {
+		auto ps = mat.ptr(r);
+		auto pt = ret.ptr(r);
+		REP(i, mat.cols() * 3)
+			*(pt++) = *(ps++) / 255.0f;
+	}
 	return ret;
 }
 
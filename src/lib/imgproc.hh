@@ -12,6 +12,10 @@ class Matrix;
 namespace pano {
 Mat32f read_img(const char* fname);
 Matuc read_img_uc(const char* fname);
+// read a grey image whose (width + height) / 2 is no less than min_size, if the image is large enough.
+// JPEG is downscaled while decoding, without a full-resolution intermediate.
+// width, height: size of the full image
+Mat32f read_img_grey(const char* fname, int min_size, int& width, int& height);
 void write_rgb(const char* fname, const Mat32f& mat);
 inline void write_rgb(const std::string s, const Mat32f& mat) { write_rgb(s.c_str(), mat); }
 
@@ -25,6 +29,7 @@ Color interpolate(const Mat32f& mat, float r, float c);
 // return value still in [0,1]
 Color interpolate(const Matuc& mat, float r, float c);
 
+// return a view of the largest rectangle without Color::NO
 Mat32f crop(const Mat32f& mat);
 
 Mat32f rgb2grey(const Mat32f& mat);
@@ -39,4 +44,6 @@ template <typename T>
 void resize(const Mat<T> &src, Mat<T> &dst);
 
 Matuc cvt_f2uc(const Mat32f& mat);
+
+Mat32f cvt_uc2f(const Matuc& mat);
 }
@@ -2,16 +2,35 @@
 
 #include <memory>
 #include <cstring>
+#include <cstdint>
+#include <type_traits>
+#include "lib/bufferpool.hh"
 #include "lib/debugutils.hh"
 
+// An image of rows x cols pixels, each with channels elements of T.
+// Rows are stored with a stride, and may be padded so that every row starts
+// at an ALIGN-byte boundary. A copy or a roi() shares the underlying buffer.
+// Buffers of trivial types allocated in a buffer_pool::Scope come from the buffer pool.
 template <typename T>
 class Mat {
     public:
+				static const int ALIGN = 64;
+
 				Mat(){}
 				Mat(int rows, int cols, int channels):
-					m_rows(rows), m_cols(cols), m_channels(channels),
-					m_data{new T[rows * cols * channels], std::default_delete<T[]>() }
-				{ }
+					Mat(rows, cols, channels, padded_stride(cols * channels)) { }
+
+				// stride: number of T between the starts of two rows
+				Mat(int rows, int cols, int channels, int stride):
+					m_rows(rows), m_cols(cols), m_channels(channels), m_stride(stride)
+				{
+					m_assert(stride >= cols * channels);
+					m_data = allocate((size_t)rows * stride);
+					m_ptr = m_data.get();
+					if (aligned())
+						while (reinterpret_cast<uintptr_t>(m_ptr) % ALIGN)
+							m_ptr++;
+				}
 
 				virtual ~Mat(){}
 
@@ -23,38 +42,78 @@ class Mat {
 				}
 
 				const T &at(int r, int c, int ch = 0) const {
-					if(r>=m_rows) print_debug("r=%d,row=%d",r,m_rows); 
+					if(r>=m_rows) print_debug("r=%d,row=%d",r,m_rows);
                                         m_assert(r < m_rows);
 					m_assert(c < m_cols);
 					m_assert(ch < m_channels);
 					return ptr(r)[c * m_channels + ch];
 				}
 
+				// a continuous Mat keeps its layout
 				Mat<T> clone() const {
-					Mat<T> res(m_rows, m_cols, m_channels);
-					memcpy(res.ptr(0), this->ptr(0), sizeof(T) * m_rows * m_cols * m_channels);
+					Mat<T> res(m_rows, m_cols, m_channels,
+							continuous() ? m_stride : padded_stride(m_cols * m_channels));
+					for (int i = 0; i < m_rows; i ++)
+						memcpy(res.ptr(i), this->ptr(i), sizeof(T) * m_cols * m_channels);
+					return res;
+				}
+
+				// a view of rows x cols pixels starting from (r, c), sharing the buffer
+				Mat<T> roi(int r, int c, int rows, int cols) const {
+					m_assert(r >= 0 && c >= 0 && r + rows <= m_rows && c + cols <= m_cols);
+					Mat<T> res(*this);
+					res.m_ptr = m_ptr + (size_t)r * m_stride + c * m_channels;
+					res.m_rows = rows, res.m_cols = cols;
 					return res;
 				}
 
 				const T *ptr(int r = 0) const
-				{ return m_data.get() + r * m_cols * m_channels; }
+				{ return m_ptr + (size_t)r * m_stride; }
 				T *ptr(int r = 0)
-				{ return m_data.get() + r * m_cols * m_channels; }
+				{ return m_ptr + (size_t)r * m_stride; }
 				const T *ptr(int r, int c) const
-				{ return m_data.get() + (r * m_cols + c) * m_channels; }
+				{ return ptr(r) + c * m_channels; }
 				T *ptr(int r, int c)
-				{ return m_data.get() + (r * m_cols + c) * m_channels; }
+				{ return ptr(r) + c * m_channels; }
 				int height() const { return m_rows; }
 				int width() const { return m_cols; }
 				int rows() const { return m_rows; }
 				int cols() const { return m_cols; }
 				int channels() const { return m_channels; }
 				int pixels() const { return m_rows * m_cols; }
+				// in number of T
+				int stride() const { return m_stride; }
+				// whether all rows are contiguous in memory
+				bool continuous() const { return m_stride == m_cols * m_channels; }
 
 		protected:
-				int m_rows, m_cols;
-				int m_channels;
+				int m_rows = 0, m_cols = 0;
+				int m_channels = 0;
+				int m_stride = 0;
+				T* m_ptr = nullptr;
 				std::shared_ptr<T> m_data;
+
+				// rows can be aligned only if ALIGN is a multiple of sizeof(T)
+				static constexpr bool aligned() { return ALIGN % sizeof(T) == 0; }
+
+				static std::shared_ptr<T> allocate(size_t n) {
+					static_assert(ALIGN == pano::buffer_pool::ALIGN, "");
+					if (std::is_trivial<T>::value && pano::buffer_pool::enabled()) {
+						size_t bytes = n * sizeof(T);
+						return std::shared_ptr<T>(
+								static_cast<T*>(pano::buffer_pool::alloc(bytes)),
+								[bytes](T* p) { pano::buffer_pool::free(p, bytes); });
+					}
+					// over-allocate, to be aligned in the constructor
+					const int extra = aligned() ? ALIGN / sizeof(T) : 0;
+					return std::shared_ptr<T>(new T[n + extra], std::default_delete<T[]>());
+				}
+
+				static int padded_stride(int n) {
+					if (! aligned()) return n;
+					const int k = ALIGN / sizeof(T);
+					return (n + k - 1) / k * k;
+				}
 };
 
 using Mat32f = Mat<float>;
@@ -10,8 +10,9 @@ class Matrix : public Mat<double> {
 	public:
 		Matrix(){}
 
+		// packed, so the elements can be used as a dense array
 		Matrix(int rows, int cols):
-			Mat<double>(rows, cols, 1) {}
+			Mat<double>(rows, cols, 1, cols) {}
 
 		Matrix(const Mat<double>& r):
 			Mat<double>(r) {}
@@ -0,0 +1,56 @@
+//File: simd.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "simd.hh"
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+using namespace pano;
+
+SIMDLevel detect_simd_level() {
+	SIMDLevel ret = SIMDLevel::NONE;
+#ifdef PANO_SIMD_DISPATCH
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		ret = SIMDLevel::SSE2;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		ret = SIMDLevel::AVX2;
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		ret = SIMDLevel::AVX512;
+#elif defined(__SSE2__) || (_M_IX86_FP >= 2) || defined(_M_X64)
+	ret = SIMDLevel::SSE2;
+#endif
+
+	// allow to lower the level for debugging / benchmarking
+	const char* env = getenv("PANO_SIMD");
+	if (env) {
+		SIMDLevel cap = ret;
+		if (! strcmp(env, "none")) cap = SIMDLevel::NONE;
+		else if (! strcmp(env, "sse2")) cap = SIMDLevel::SSE2;
+		else if (! strcmp(env, "avx2")) cap = SIMDLevel::AVX2;
+		if (cap < ret) ret = cap;
+	}
+	return ret;
+}
+
+}
+
+namespace pano {
+
+SIMDLevel simd_level() {
+	static const SIMDLevel level = detect_simd_level();
+	return level;
+}
+
+const char* simd_level_name(SIMDLevel level) {
+	switch (level) {
+		case SIMDLevel::SSE2: return "sse2";
+		case SIMDLevel::AVX2: return "avx2";
+		case SIMDLevel::AVX512: return "avx512";
+		default: return "none";
+	}
+}
+
+}
@@ -0,0 +1,32 @@
+//File: simd.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+
+// Runtime detection of the SIMD instruction set.
+// Kernels are compiled for several targets with PANO_TARGET and
+// the best one is chosen once by simd_level().
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PANO_SIMD_DISPATCH
+#define PANO_TARGET(x) __attribute__((target(x)))
+#include <immintrin.h>
+#else
+#define PANO_TARGET(x)
+#endif
+
+namespace pano {
+
+enum class SIMDLevel {
+	NONE = 0,
+	SSE2,
+	AVX2,		// AVX2 + FMA
+	AVX512	// AVX512F + AVX512BW
+};
+
+// detected once, then cached
+SIMDLevel simd_level();
+
+const char* simd_level_name(SIMDLevel level);
+
+}
@@ -5,6 +5,7 @@
 #include <map>
 #include <iostream>
 #include <string>
+#include "bufferpool.hh"
 
 class Timer {
 	public:
@@ -78,7 +79,10 @@ class TotalTimer {
 
 // Build a global instance of this class, to call print() before program exit.
 struct TotalTimerGlobalGuard {
-	~TotalTimerGlobalGuard() { TotalTimer::print(); }
+	~TotalTimerGlobalGuard() {
+		TotalTimer::print();
+		pano::buffer_pool::print_stats();
+	}
 };
 
 
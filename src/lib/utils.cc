@@ -3,6 +3,14 @@
 // Author: Yuxin Wu <ppwwyyxxc@gmail.com>
 
 #include "utils.hh"
+#include <functional>
+#include <thread>
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
 
 std::string TERM_COLOR(int k) {
 	// k = 0 ~ 4
@@ -64,3 +72,8 @@ std::string ssprintf(const char *fmt, ...) {
 			p = np;
 	}
 }
+
+std::string temp_file_name(const std::string& fname) {
+	unsigned long long tid = std::hash<std::thread::id>()(std::this_thread::get_id());
+	return ssprintf("%s.%d.%llx.tmp", fname.c_str(), (int)getpid(), tid);
+}
@@ -84,6 +84,10 @@ inline bool exists_file(const char* name) {
 	return stat(name, &buffer) == 0;
 }
 
+// a name next to fname for a temporary file, unique to the calling process and thread,
+// so that concurrent writers of fname never write the same file before renaming it
+std::string temp_file_name(const std::string& fname);
+
 inline bool endswith(const char* str, const char* suffix) {
 	if (!str || !suffix) return false;
 	auto l1 = strlen(str), l2 = strlen(suffix);
@@ -6,15 +6,20 @@
 #include <cmath>
 
 #include "feature/mysift.h"
+#include "feature/calibration.hh"
 #include "feature/extrema.hh"
+#include "feature/extrema_scan.hh"
 #include "feature/matcher.hh"
 #include "feature/orientation.hh"
+#include "feature/retrieval.hh"
 #include "lib/mat.h"
 #include "lib/config.hh"
+#include "lib/convolve.hh"
 #include "lib/geometry.hh"
 #include "lib/imgproc.hh"
 #include "lib/planedrawer.hh"
 #include "lib/polygon.hh"
+#include "lib/simd.hh"
 #include "lib/timer.hh"
 #include "stitch/cylstitcher.hh"
 #include "stitch/match_info.hh"
@@ -23,6 +28,7 @@
 #include "stitch/warp.hh"
 #include <ctime>
 #include <cassert>
+#include <set>
 
 using namespace std;
 using namespace pano;
@@ -87,9 +93,9 @@ void test_match(const char* f1, const char* f2) {
 
 	unique_ptr<FeatureDetector> detector;
 	detector.reset(new SIFTDetector);
-	vector<Descriptor> feat1 = detector->detect_feature(pic1),
-										 feat2 = detector->detect_feature(pic2);
-	print_debug("Feature: %lu, %lu\n", feat1.size(), feat2.size());
+	FeatureSet feat1 = detector->detect_feature(pic1),
+						 feat2 = detector->detect_feature(pic2);
+	print_debug("Feature: %d, %d\n", feat1.size(), feat2.size());
 
 	Mat32f concatenated = hconcat(imagelist);
 	PlaneDrawer pld(concatenated);
@@ -99,8 +105,8 @@ void test_match(const char* f1, const char* f2) {
 	print_debug("Match size: %d\n", ret.size());
 	for (auto &x : ret.data) {
 		pld.set_rand_color();
-		Vec2D coor1 = feat1[x.first].coor,
-					coor2 = feat2[x.second].coor;
+		Vec2D coor1 = feat1.coor[x.first],
+					coor2 = feat2.coor[x.second];
 		Coor icoor1 = Coor(coor1.x + pic1.width()/2, coor1.y + pic1.height()/2);
 		Coor icoor2 = Coor(coor2.x + pic2.width()/2 + pic1.width(), coor2.y + pic2.height()/2);
 		pld.circle(icoor1, LABEL_LEN);
@@ -120,11 +126,9 @@ void test_inlier(const char* f1, const char* f2) {
 
 	unique_ptr<FeatureDetector> detector;
 	detector.reset(new SIFTDetector);
-	vector<Descriptor> feat1 = detector->detect_feature(pic1),
-										 feat2 = detector->detect_feature(pic2);
-	vector<Vec2D> kp1; for (auto& d : feat1) kp1.emplace_back(d.coor);
-	vector<Vec2D> kp2; for (auto& d : feat2) kp2.emplace_back(d.coor);
-	print_debug("Feature: %lu, %lu\n", feat1.size(), feat2.size());
+	FeatureSet feat1 = detector->detect_feature(pic1),
+						 feat2 = detector->detect_feature(pic2);
+	print_debug("Feature: %d, %d\n", feat1.size(), feat2.size());
 
 	Mat32f concatenated = hconcat(imagelist);
 	PlaneDrawer pld(concatenated);
@@ -132,7 +136,7 @@ void test_inlier(const char* f1, const char* f2) {
 	auto ret = match.match();
 	print_debug("Match size: %d\n", ret.size());
 
-	TransformEstimation est(ret, kp1, kp2,
+	TransformEstimation est(ret, feat1.coor, feat2.coor,
 			{pic1.width(), pic1.height()}, {pic2.width(), pic2.height()});
 	MatchInfo info;
 	est.get_transform(&info);
@@ -199,6 +203,242 @@ void test_warp(int argc, char* argv[]) {
 }
 
 
+// the 2D convolution previously used by mySIFT, as the baseline in bench_gaussian
+void naive_convolve(const Mat32f& src, const vector<double>& filter,
+		Mat32f& dst, int a, int b) {
+	dst = src.clone();
+	for (int x = a; x < src.rows() - a; x++)
+		for (int y = b; y < src.cols() - b; y++) {
+			float sum = 0.0;
+			for (int s = -a; s <= a; s++)
+				for (int t = -b; t <= b; t++)
+					sum += filter[s + a + t + b] * src.at(x + s, y + t);
+			dst.at(x, y) = sum;
+		}
+}
+
+// compare throughput of gaussian blur on a SIFT-working-size image
+void bench_gaussian(const char* fname) {
+	auto mat = read_img(fname);
+	float ratio = SIFT_WORKING_SIZE * 2.0f / (mat.width() + mat.height());
+	Mat32f resized(mat.rows() * ratio, mat.cols() * ratio, 3);
+	resize(mat, resized);
+	Mat32f grey = rgb2grey(resized);
+	double mpix = grey.pixels() / 1e6;
+	print_debug("Blur %dx%d image with simd=%s\n",
+			grey.width(), grey.height(), simd_level_name(simd_level()));
+
+	const int NR_RUN = 5;
+	for (double sigma : {0.8, 1.2, 1.6, 2.0, 2.5, 3.2, 4.0, 5.0}) {
+		GaussianMask mask(sigma);
+		int size = mask.getSize(), center = size / 2;
+		vector<double> dfilter(mask.getFullMask(), mask.getFullMask() + size);
+		vector<float> filter(dfilter.begin(), dfilter.end());
+
+		Mat32f tmp, out;
+		Timer tm;
+		REP(k, NR_RUN) {
+			naive_convolve(grey, dfilter, tmp, center, 0);
+			naive_convolve(tmp, dfilter, out, 0, center);
+		}
+		double t_old = tm.duration() / NR_RUN;
+		tm.restart();
+		REP(k, NR_RUN)
+			out = convolve_separable(grey, filter.data() + center, center);
+		double t_new = tm.duration() / NR_RUN;
+		print_debug("sigma=%.1lf, kernel width %2d: old %7.2lf Mpix/s, new %7.2lf Mpix/s, %5.1lfx\n",
+				sigma, size, mpix / t_old, mpix / t_new, t_old / t_new);
+	}
+}
+
+// the per-pixel 26-neighbour test previously used by mySIFT, as the baseline in bench_extrema
+bool naive_is_extremum(const Mat32f* dogs, int r, int c) {
+	bool maximum = true, minimum = true;
+	float cur = dogs[1].at(r, c);
+	REP(i, 3) REPL(dr, -1, 2) REPL(dc, -1, 2) {
+		float v = dogs[i].at(r + dr, c + dc);
+		if (cur < v) maximum = false;
+		if (cur > v) minimum = false;
+		if (!maximum && !minimum) return false;
+	}
+	return true;
+}
+
+// compare the extrema scan on each DoG layer of a SIFT-working-size image
+void bench_extrema(const char* fname) {
+	auto mat = read_img(fname);
+	float ratio = SIFT_WORKING_SIZE * 2.0f / (mat.width() + mat.height());
+	Mat32f resized(mat.rows() * ratio, mat.cols() * ratio, 3);
+	resize(mat, resized);
+	print_debug("Scan DoG of %dx%d image with simd=%s\n",
+			resized.width(), resized.height(), simd_level_name(simd_level()));
+
+	const PyramidKernels& kernels = PyramidKernels::get(INTERVALS, SIGMA);
+	Mat32f base = kernels.blur(0, rgb2grey(resized));
+	const int NR_RUN = 5, B = SIFT_IMG_BORDER;
+	REP(o, 3) {
+		vector<Mat32f> gaus{base};
+		REPL(j, 1, INTERVALS + 3)
+			gaus.emplace_back(kernels.blur(j, gaus.back()));
+		vector<Mat32f> dogs;
+		REP(j, INTERVALS + 2) {
+			Mat32f d(base.rows(), base.cols(), 1);
+			REP(r, d.rows()) REP(k, d.cols())
+				d.ptr(r)[k] = gaus[j + 1].ptr(r)[k] - gaus[j].ptr(r)[k];
+			dogs.emplace_back(move(d));
+		}
+		int h = base.rows(), w = base.cols();
+		double mpix = (h - 2 * B) * (w - 2 * B) / 1e6;
+
+		REPL(l, 1, INTERVALS + 1) {
+			int nr_old = 0;
+			Timer tm;
+			REP(k, NR_RUN) {
+				nr_old = 0;
+				REPL(r, B, h - B) REPL(c, B, w - B)
+					nr_old += naive_is_extremum(&dogs[l - 1], r, c);
+			}
+			double t_old = tm.duration() / NR_RUN;
+
+			vector<int> cand;
+			size_t nr_new = 0;
+			tm.restart();
+			REP(k, NR_RUN) {
+				nr_new = 0;
+				REPL(r, B, h - B) {
+					const float* rows[3][3];
+					REP(i, 3) REP(j, 3)
+						rows[i][j] = dogs[l - 1 + i].ptr(r - 1 + j);
+					cand.clear();
+					scan_extrema_row(rows, B, w - B, SIFT_PRE_CONTR_THR, cand);
+					nr_new += cand.size();
+				}
+			}
+			double t_new = tm.duration() / NR_RUN;
+			print_debug("octave %d layer %d: old %7.2lf Mpix/s, new %7.2lf Mpix/s, %5.1lfx, "
+					"candidates %d -> %lu\n",
+					o, l, mpix / t_old, mpix / t_new, t_old / t_new, nr_old, nr_new);
+		}
+
+		Mat32f next(h / 2, w / 2, 1);
+		REP(r, next.rows()) REP(c, next.cols()) {
+			const Mat32f& g = gaus[INTERVALS];
+			next.at(r, c) = (g.at(r * 2, c * 2) + g.at(r * 2 + 1, c * 2) +
+					g.at(r * 2, c * 2 + 1) + g.at(r * 2 + 1, c * 2 + 1)) / 4;
+		}
+		base = move(next);
+	}
+}
+
+// compare matching on float and on quantized descriptors
+void bench_match(const char* f1, const char* f2) {
+	vector<FeatureSet> feats;
+	{
+		SIFTDetector detector;
+		bool quantize = DESC_QUANTIZE;
+		DESC_QUANTIZE = false;
+		feats.emplace_back(detector.detect_feature(read_img(f1)));
+		feats.emplace_back(detector.detect_feature(read_img(f2)));
+		DESC_QUANTIZE = quantize;
+	}
+	print_debug("Feature: %d, %d, simd=%s\n", feats[0].size(), feats[1].size(),
+			simd_level_name(simd_level()));
+
+	const int NR_RUN = 5;
+	auto run = [&](const char* name) {
+		MatchData brute, tree;
+		Timer tm;
+		REP(k, NR_RUN)
+			brute = FeatureMatcher(feats[0], feats[1]).match();
+		double t_brute = tm.duration() / NR_RUN;
+		tm.restart();
+		REP(k, NR_RUN)
+			tree = PairWiseMatcher(feats).match(0, 1);
+		double t_tree = tm.duration() / NR_RUN;
+		print_debug("%s: brute-force %.4lfs with %d matches, kd-tree %.4lfs with %d matches\n",
+				name, t_brute, brute.size(), t_tree, tree.size());
+		return brute;
+	};
+	auto ref = run("float");
+	for (auto& f : feats)
+		f.quantize(DESC_INT_FACTOR);
+	auto q = run("uint8");
+
+	set<pair<int, int>> ref_set(ref.data.begin(), ref.data.end());
+	int nr_same = 0;
+	for (auto& p : q.data)
+		nr_same += ref_set.count(p);
+	print_debug("%d of %d uint8 matches agree with float\n", nr_same, q.size());
+}
+
+// recall of the pairs shortlisted by retrieval, against matching all pairs
+void bench_retrieval(int argc, char* argv[]) {
+	vector<FeatureSet> feats;
+	vector<Shape2D> shapes;
+	auto detector = create_feature_detector();
+	REPL(i, 2, argc) {
+		Mat32f img = read_img(argv[i]);
+		shapes.emplace_back(img.width(), img.height());
+		feats.emplace_back(detector->detect_feature(img));
+	}
+	const int n = feats.size();
+
+	Timer tm;
+	set<pair<int, int>> truth;
+	{
+		PairWiseMatcher pwmatcher(feats);
+		REP(i, n) REPL(j, i + 1, n) {
+			auto match = pwmatcher.match(i, j);
+			TransformEstimation transf(match, feats[i].coor, feats[j].coor,
+					shapes[i], shapes[j]);
+			MatchInfo info;
+			if (transf.get_transform(&info))
+				truth.emplace(i, j);
+		}
+	}
+	double t_all = tm.duration();
+	tm.restart();
+	ImageRetrieval retrieval(feats);
+	print_debug("%lu of %d pairs match, in %.3lfs. retrieval takes %.3lfs\n",
+			truth.size(), n * (n - 1) / 2, t_all, tm.duration());
+
+	REPL(k, 1, n) {
+		auto pairs = retrieval.shortlist(k);
+		int nr_hit = 0;
+		for (auto& p : pairs)
+			nr_hit += truth.count(p);
+		print_debug("k=%d: %lu pairs, recall %d/%lu\n", k, pairs.size(), nr_hit, truth.size());
+		if ((int)pairs.size() == n * (n - 1) / 2)
+			break;
+	}
+}
+
+// recall and speed of the FLANN settings against exact matching, on a sample of images
+void calibrate_flann(int argc, char* argv[]) {
+	vector<FeatureSet> feats;
+	auto detector = create_feature_detector();
+	REPL(i, 2, argc)
+		feats.emplace_back(detector->detect_feature(read_img(argv[i])));
+	const int n = feats.size();
+	int nr_feature = 0;
+	for (auto& f : feats)
+		nr_feature += f.size();
+	print_debug("%d images, %d features per image\n", n, nr_feature / n);
+
+	FlannCalibration calib(feats);
+	auto results = calib.run();
+	double brute_force_time = calib.brute_force_time();
+	print_debug("brute-force: %.4lfs per pair\n", brute_force_time);
+	auto best = calib.choose(results, FLANN_TARGET_RECALL);
+	print_debug("fastest with recall >= %g: recall %.4f, %.4lfs per pair. settings for config.cfg:\n",
+			FLANN_TARGET_RECALL, best.recall, best.pair_time(n));
+	printf("%s", best.params.to_config().c_str());
+	// brute force grows quadratically with the number of features per image, and the index
+	// about linearly. they take the same time per pair at this size
+	int max_feature = nr_feature / n * best.pair_time(n) / brute_force_time;
+	printf("BRUTE_FORCE_MATCH_MAX_FEATURE %d\n", max_feature / 100 * 100);
+}
+
 void work(int argc, char* argv[]) {
 /*
  *  vector<Mat32f> imgs(argc - 1);
@@ -259,7 +499,12 @@ void init_config() {
 	CFG(FOCAL_LENGTH);
 	CFG(MAX_OUTPUT_SIZE);
 	CFG(LAZY_READ);	// TODO in cyl mode
+	CFG(FEATURE_MEMORY_BUDGET);
+	CFG(FEATURE_CACHE);
 
+	CFG(FEATURE_DETECTOR);
+	CFG(ORB_NR_FEATURE);
+	CFG(ORB_FAST_THRES);
 	CFG(SIFT_WORKING_SIZE);
 	CFG(NUM_OCTAVE);
 	CFG(NUM_SCALE);
@@ -276,11 +521,24 @@ void init_config() {
 	CFG(ORI_HIST_SMOOTH_COUNT);
 	CFG(DESC_HIST_SCALE_FACTOR);
 	CFG(DESC_INT_FACTOR);
+	CFG(DESC_QUANTIZE);
 	CFG(MATCH_REJECT_NEXT_RATIO);
+	CFG(MATCH_TOP_K);
+	CFG(MATCH_GLOBAL_K);
+	CFG(BRUTE_FORCE_MATCH_MAX_FEATURE);
+	CFG(FLANN_INDEX);
+	CFG(FLANN_NR_KDTREE);
+	CFG(FLANN_BRANCHING);
+	CFG(FLANN_KMEANS_ITERATIONS);
+	CFG(FLANN_KMEANS_CB_INDEX);
+	CFG(FLANN_CHECKS);
+	CFG(FLANN_TARGET_RECALL);
 	CFG(RANSAC_ITERATIONS);
 	CFG(RANSAC_INLIER_THRES);
 	CFG(INLIER_IN_MATCH_RATIO);
 	CFG(INLIER_IN_POINTS_RATIO);
+	CFG(GUIDED_MATCH);
+	CFG(GUIDED_MATCH_RADIUS);
 	CFG(SLOPE_PLAIN);
 	CFG(LM_LAMBDA);
 	CFG(MULTIPASS_BA);
@@ -348,6 +606,16 @@ int main(int argc, char* argv[]) {
 		test_warp(argc, argv);
 	else if (command == "planet")
 		planet(argv[2]);
+	else if (command == "bench_gaussian")
+		bench_gaussian(argv[2]);
+	else if (command == "bench_extrema")
+		bench_extrema(argv[2]);
+	else if (command == "bench_match")
+		bench_match(argv[2], argv[3]);
+	else if (command == "bench_retrieval")
+		bench_retrieval(argc, argv);
+	else if (command == "calibrate_flann")
+		calibrate_flann(argc, argv);
 	else
 		// the real routine
 		work(argc, argv);
@@ -28,7 +28,7 @@ Mat32f LinearBlender::run() {
 					Vec2D img_coor = img.map_coor(i, j); \
 					if (img_coor.isNaN()) continue; \
 					float r = img_coor.y, c = img_coor.x; \
-					auto color = interpolate(*img.imgref.img, r, c); \
+					auto color = img.imgref.interpolate(r, c); \
 					if (color.x < 0) continue; \
 					float	w = 0.5 - fabs(c / img.imgref.width() - 0.5); \
 					if (not config::ORDERED_INPUT) /* blend both direction */\
@@ -39,7 +39,8 @@ Mat32f LinearBlender::run() {
 		// use weighted pixel, to iterate over images (and free them) instead of target
 		// will be a little bit slower
 		Mat<float> weight(target_size.y, target_size.x, 1);
-		memset(weight.ptr(), 0, target_size.y * target_size.x * sizeof(float));
+		REP(i, weight.rows())
+			memset(weight.ptr(i), 0, weight.cols() * sizeof(float));
 		fill(target, Color::BLACK);
 #pragma omp parallel for schedule(dynamic)
 		REP(k, images.size()) {
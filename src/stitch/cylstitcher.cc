@@ -35,7 +35,7 @@ void CylinderStitcher::build_warp() {;
 
 	Timer timer;
 	vector<MatchData> matches;		// matches[k]: k,k+1
-	PairWiseMatcher pwmatcher(feats);
+	PairWiseMatcher pwmatcher(feats, index_file());
 	matches.resize(n-1);
 #pragma omp parallel for schedule(dynamic)
 	REP(k, n - 1)
@@ -62,9 +62,10 @@ void CylinderStitcher::build_warp() {;
 	}
 	print_debug("Best hfactor: %lf\n", bestfactor);
 	CylinderWarper warper(bestfactor);
+#pragma omp parallel for schedule(dynamic)
 	REP(k, n) imgs[k].load();
 #pragma omp parallel for schedule(dynamic)
-	REP(k, n) warper.warp(*imgs[k].img, keypoints[k]);
+	REP(k, n) warper.warp(imgs[k].make_float(), feats[k].coor);
 
 	// accumulate
 	REPL(k, mid + 1, n) bundle.component[k].homo = move(bestmat[k - mid - 1]);
@@ -73,7 +74,7 @@ void CylinderStitcher::build_warp() {;
 		matches[i].reverse();
 		MatchInfo info;
 		bool succ = TransformEstimation(
-				matches[i], keypoints[i + 1], keypoints[i],
+				matches[i], feats[i + 1].coor, feats[i].coor,
 				imgs[i+1].shape(), imgs[i].shape()).get_transform(&info);
 		// Can match before, but not here. This would be a bug.
 		if (! succ)
@@ -100,7 +101,7 @@ float CylinderStitcher::update_h_factor(float nowfactor,
 	vector<vector<Vec2D>> nowkpts;
 	REPL(k, start, end) {
 		nowimgs.emplace_back(imgs[k].shape());
-		nowkpts.push_back(keypoints[k]);
+		nowkpts.push_back(feats[k].coor);
 	}			// nowfeats[0] == feats[mid]
 
 	CylinderWarper warper(nowfactor);
@@ -172,7 +173,7 @@ Mat32f CylinderStitcher::perspective_correction(const Mat32f& img) {
 
 	LinearBlender blender;
 	ImageRef tmp("this_should_not_be_used");
-	tmp.img = new Mat32f(img);
+	tmp.fimg = new Mat32f(img);
 	tmp._width = img.width(), tmp._height = img.height();
 	blender.add_image(
 			Coor(0,0), Coor(w,h), tmp,
@@ -31,7 +31,7 @@ void LinearBlender::debug_run(int w, int h) {
 					Vec2D img_coor = img.map_coor(i, j);
 					if (!img_coor.isNaN()) {
 						float r = img_coor.y, c = img_coor.x;
-						isum = interpolate(*img.imgref.img, r, c);
+						isum = img.imgref.interpolate(r, c);
 					}
 				}
 				isum.write_to(row + j * 3);
@@ -67,6 +67,7 @@ void MultiBandBlender::debug_level(int level) const {
 
 void Stitcher::draw_matchinfo() {
 	int n = imgs.size();
+#pragma omp parallel for schedule(dynamic)
 	REP(i, n) imgs[i].load();
 #pragma omp parallel for schedule(dynamic)
 	REP(i, n) REPL(j, i+1, n) {
@@ -78,7 +79,7 @@ void Stitcher::draw_matchinfo() {
 		auto& m = pairwise_matches[i][j];
 		if (m.confidence <= 0)
 			continue;
-		list<Mat32f> imagelist{*imgs[i].img, *imgs[j].img};
+		list<Mat32f> imagelist{imgs[i].to_float(), imgs[j].to_float()};
 		Mat32f conc = hconcat(imagelist);
 		PlaneDrawer pld(conc);
 		for (auto& p : m.match) {
@@ -0,0 +1,204 @@
+//File: feature_cache.cc
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#include "feature_cache.hh"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "feature/matcher.hh"
+#include "lib/config.hh"
+#include "lib/debugutils.hh"
+#include "lib/utils.hh"
+
+using namespace std;
+using namespace config;
+
+namespace {
+
+const char MAGIC[4] = {'P', 'F', 'E', 'A'};
+// bump when the layout or the detector changes
+const uint32_t VERSION = 1;
+// bump when the index or its parameters change
+const uint32_t INDEX_VERSION = 1;
+
+struct Header {
+	char magic[4];
+	uint32_t version;
+	int32_t type, dim, row_bytes, size;
+	int32_t width, height;
+	uint64_t desc_offset;		// in bytes, aligned to FeatureSet::ALIGN
+};
+
+// FNV-1a
+class Hasher {
+	public:
+		void update(const void* buf, size_t len) {
+			const uint8_t* p = static_cast<const uint8_t*>(buf);
+			REP(i, len)
+				h = (h ^ p[i]) * 1099511628211ULL;
+		}
+		template <typename T>
+		void update(const T& v) { update(&v, sizeof(T)); }
+
+		uint64_t digest() const { return h; }
+	private:
+		uint64_t h = 14695981039346656037ULL;
+};
+
+size_t desc_offset(int n) {
+	const size_t a = pano::FeatureSet::ALIGN;
+	return (sizeof(Header) + n * 2 * sizeof(double) + a - 1) / a * a;
+}
+
+}
+
+namespace pano {
+
+FeatureCache::FeatureCache(const string& dir): dir(dir) {
+	if (exists_file(dir.c_str()))
+		return;
+#ifdef _MSC_VER
+	int err = _mkdir(dir.c_str());
+#else
+	int err = mkdir(dir.c_str(), 0755);
+#endif
+	if (err)
+		error_exit(ssprintf("Cannot create feature cache directory %s\n", dir.c_str()));
+}
+
+string FeatureCache::entry(const string& fname) const {
+	Hasher h;
+	ifstream fin(fname, ios::binary);
+	if (! fin)
+		error_exit(ssprintf("Cannot open %s\n", fname.c_str()));
+	vector<char> buf(1 << 20);
+	while (fin) {
+		fin.read(buf.data(), buf.size());
+		h.update(buf.data(), fin.gcount());
+	}
+
+	// everything that changes the detected features
+	h.update(VERSION);
+	h.update(FEATURE_DETECTOR);
+	h.update(SIFT_WORKING_SIZE);
+	h.update(LAZY_READ);		// lazy read detects on the scaled luma of JPEG
+	h.update(NUM_OCTAVE); h.update(NUM_SCALE);
+	h.update(SCALE_FACTOR); h.update(GAUSS_SIGMA); h.update(GAUSS_WINDOW_FACTOR);
+	h.update(JUDGE_EXTREMA_DIFF_THRES); h.update(CONTRAST_THRES);
+	h.update(PRE_COLOR_THRES); h.update(EDGE_RATIO);
+	h.update(CALC_OFFSET_DEPTH); h.update(OFFSET_THRES);
+	h.update(ORI_RADIUS); h.update(ORI_HIST_SMOOTH_COUNT);
+	h.update(DESC_HIST_SCALE_FACTOR); h.update(DESC_INT_FACTOR); h.update(DESC_QUANTIZE);
+	h.update(ORB_NR_FEATURE); h.update(ORB_FAST_THRES);
+	return ssprintf("%s/%016llx.feat", dir.c_str(), (unsigned long long)h.digest());
+}
+
+bool FeatureCache::load(const string& entry, FeatureSet& feat, Shape2D& shape) const {
+	struct stat st;
+	if (stat(entry.c_str(), &st) != 0 || (size_t)st.st_size < sizeof(Header))
+		return false;
+	const size_t len = st.st_size;
+
+	shared_ptr<uint8_t> owner;
+	uint8_t* base;
+#ifdef _MSC_VER
+	// read into an aligned buffer instead
+	owner.reset(new uint8_t[len + FeatureSet::ALIGN], default_delete<uint8_t[]>());
+	base = owner.get();
+	while (reinterpret_cast<uintptr_t>(base) % FeatureSet::ALIGN)
+		base++;
+	ifstream fin(entry, ios::binary);
+	if (! fin.read(reinterpret_cast<char*>(base), len))
+		return false;
+#else
+	int fd = open(entry.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	// private mapping: pages are copied only if the descriptors are modified
+	void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return false;
+	base = static_cast<uint8_t*>(addr);
+	owner.reset(base, [len](uint8_t* p) { munmap(p, len); });
+#endif
+
+	Header hd;
+	memcpy(&hd, base, sizeof(hd));
+	if (memcmp(hd.magic, MAGIC, sizeof(MAGIC)) || hd.version != VERSION ||
+			hd.desc_offset != desc_offset(hd.size) ||
+			hd.desc_offset + (size_t)hd.size * hd.row_bytes != len)
+		return false;
+
+	FeatureSet ret(hd.dim, 0, static_cast<FeatureSet::Type>(hd.type));
+	if (ret.row_bytes() != hd.row_bytes)
+		return false;
+	ret.attach(hd.size, base + hd.desc_offset, owner);
+	memcpy(ret.coor.data(), base + sizeof(Header), hd.size * 2 * sizeof(double));
+	feat = move(ret);
+	shape = Shape2D{hd.width, hd.height};
+	return true;
+}
+
+void FeatureCache::save(const string& entry, const FeatureSet& feat, const Shape2D& shape) const {
+	static_assert(sizeof(Vec2D) == 2 * sizeof(double), "Vec2D is not packed!");
+	Header hd;
+	memcpy(hd.magic, MAGIC, sizeof(MAGIC));
+	hd.version = VERSION;
+	hd.type = static_cast<int32_t>(feat.type());
+	hd.dim = feat.dim();
+	hd.row_bytes = feat.row_bytes();
+	hd.size = feat.size();
+	hd.width = shape.w, hd.height = shape.h;
+	hd.desc_offset = desc_offset(feat.size());
+
+	// write to a temporary file of this writer then rename,
+	// so a concurrent reader or writer never sees a partial entry
+	string tmp = temp_file_name(entry);
+	{
+		ofstream fout(tmp, ios::binary);
+		fout.write(reinterpret_cast<const char*>(&hd), sizeof(hd));
+		fout.write(reinterpret_cast<const char*>(feat.coor.data()), feat.size() * sizeof(Vec2D));
+		vector<char> pad(hd.desc_offset - sizeof(hd) - feat.size() * sizeof(Vec2D), 0);
+		fout.write(pad.data(), pad.size());
+		if (feat.size())
+			fout.write(reinterpret_cast<const char*>(feat.qdescriptor(0)),
+					(size_t)feat.size() * feat.row_bytes());
+		if (! fout) {
+			print_debug("Failed to write feature cache %s\n", tmp.c_str());
+			remove(tmp.c_str());
+			return;
+		}
+	}
+	if (rename(tmp.c_str(), entry.c_str()) != 0)
+		remove(tmp.c_str());
+}
+
+string FeatureCache::index_entry(const string& entry, const FeatureSet& feat) const {
+	Hasher h;
+	h.update(INDEX_VERSION);
+	h.update(feat.type()); h.update(feat.dim()); h.update(feat.size());
+	if (feat.size())
+		h.update(feat.qdescriptor(0), (size_t)feat.size() * feat.row_bytes());
+	if (feat.binary()) {
+		h.update(FLANN_LSH_NR_TABLE); h.update(FLANN_LSH_KEY_SIZE); h.update(FLANN_LSH_MULTI_PROBE);
+	} else {
+		FlannParams p;
+		h.update(p.algo); h.update(p.nr_kdtree); h.update(p.branching);
+		h.update(p.iterations); h.update(p.cb_index);
+	}
+	string base = entry.substr(0, entry.rfind('.'));
+	return ssprintf("%s.%016llx.index", base.c_str(), (unsigned long long)h.digest());
+}
+
+}
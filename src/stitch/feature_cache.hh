@@ -0,0 +1,36 @@
+//File: feature_cache.hh
+//Author: Yuxin Wu <ppwwyyxx@gmail.com>
+
+#pragma once
+#include <string>
+#include "feature/feature.hh"
+#include "match_info.hh"
+
+namespace pano {
+
+// Persistent cache of the features of images.
+// An entry is keyed by a hash of the image file and the config values used by the detector.
+// Its layout is [header][coordinates][descriptor rows], with rows aligned to FeatureSet::ALIGN,
+// so the descriptors are used directly in the mapped file.
+class FeatureCache {
+	public:
+		explicit FeatureCache(const std::string& dir);
+
+		// path of the entry for an image file
+		std::string entry(const std::string& fname) const;
+
+		// return false if the entry doesn't exist or is invalid.
+		// shape: of the image
+		bool load(const std::string& entry, FeatureSet& feat, Shape2D& shape) const;
+
+		void save(const std::string& entry, const FeatureSet& feat, const Shape2D& shape) const;
+
+		// path of the matching index of the features in an entry, for the current index config.
+		// keyed by the descriptors, so an index is reused only if they are unchanged
+		std::string index_entry(const std::string& entry, const FeatureSet& feat) const;
+
+	protected:
+		std::string dir;
+};
+
+}
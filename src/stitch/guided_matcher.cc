@@ -0,0 +1,116 @@
+//File: guided_matcher.cc
+//Author: Yuxin Wu <ppwwyyxxc@gmail.com>
+
+#include "guided_matcher.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "lib/config.hh"
+#include "lib/timer.hh"
+using namespace std;
+using namespace config;
+
+namespace pano {
+
+GuidedMatcher::GuidedMatcher(const FeatureSet& feat1, const FeatureSet& feat2,
+		const Shape2D& shape1, float radius):
+	feat1(feat1), feat2(feat2), shape1(shape1), radius(radius)
+{
+	m_assert(radius > 0);
+	grid_w = max((int)ceil(shape1.w / radius), 1);
+	grid_h = max((int)ceil(shape1.h / radius), 1);
+
+	// bucket features of the first image by counting sort
+	vector<int> cells(feat1.size());
+	cell_start.assign(grid_w * grid_h + 1, 0);
+	REP(i, feat1.size()) {
+		const Vec2D& p = feat1.coor[i];
+		cells[i] = cell_y(p.y) * grid_w + cell_x(p.x);
+		cell_start[cells[i] + 1] ++;
+	}
+	REP(i, grid_w * grid_h)
+		cell_start[i + 1] += cell_start[i];
+	cell_feat.resize(feat1.size());
+	vector<int> pos(cell_start.begin(), cell_start.end() - 1);
+	REP(i, feat1.size())
+		cell_feat[pos[cells[i]] ++] = i;
+}
+
+int GuidedMatcher::cell_x(double x) const {
+	int c = floor((x + shape1.halfw()) / radius);
+	return min(max(c, 0), grid_w - 1);
+}
+
+int GuidedMatcher::cell_y(double y) const {
+	int c = floor((y + shape1.halfh()) / radius);
+	return min(max(c, 0), grid_h - 1);
+}
+
+MatchData GuidedMatcher::match(const Homography& homo) const {
+	TotalTimer tm("guided match");
+	static const float REJECT_RATIO_SQR = MATCH_REJECT_NEXT_RATIO * MATCH_REJECT_NEXT_RATIO;
+	const float radius_sqr = radius * radius;
+	bool binary = feat1.binary();
+	m_assert(binary == feat2.binary());
+
+	// best match in the first image of each feature in the second image
+	int n = feat2.size();
+	vector<int> best(n, -1);
+	vector<float> best_dist(n);
+#pragma omp parallel for schedule(dynamic, 64)
+	REP(j, n) {
+		Vec2D p = homo.trans2d(feat2.coor[j]);
+		if (std::isnan(p.x) || std::isnan(p.y))
+			continue;
+		if (p.x < -shape1.halfw() - radius || p.x >= shape1.halfw() + radius ||
+				p.y < -shape1.halfh() - radius || p.y >= shape1.halfh() + radius)
+			continue;
+		float min = numeric_limits<float>::max(),
+					next_min = min;
+		int min_idx = -1;
+		int x0 = cell_x(p.x - radius), x1 = cell_x(p.x + radius),
+				y0 = cell_y(p.y - radius), y1 = cell_y(p.y + radius);
+		for (int y = y0; y <= y1; y ++)
+			for (int x = x0; x <= x1; x ++) {
+				int c = y * grid_w + x;
+				for (int k = cell_start[c]; k < cell_start[c + 1]; k ++) {
+					int i = cell_feat[k];
+					if ((feat1.coor[i] - p).sqr() >= radius_sqr)
+						continue;
+					float dist = binary ?
+						feat2.hamming(j, feat1, i) :
+						feat2.euclidean_sqr(j, feat1, i, next_min);
+					if (dist < min) {
+						next_min = min;
+						min = dist;
+						min_idx = i;
+					} else
+						update_min(next_min, dist);
+				}
+			}
+		if (min_idx == -1)
+			continue;
+		// a single candidate is accepted, as the position already agrees with the transform
+		if (binary ? min > MATCH_REJECT_NEXT_RATIO * next_min : min > REJECT_RATIO_SQR * next_min)
+			continue;
+		best[j] = min_idx;
+		best_dist[j] = min;
+	}
+
+	// keep one match for each feature in the first image
+	vector<int> owner(feat1.size(), -1);
+	REP(j, n) if (best[j] != -1) {
+		int& o = owner[best[j]];
+		if (o == -1 || best_dist[j] < best_dist[o])
+			o = j;
+	}
+	MatchData ret;
+	REP(j, n)
+		if (best[j] != -1 && owner[best[j]] == j)
+			ret.data.emplace_back(best[j], j);
+	return ret;
+}
+
+}
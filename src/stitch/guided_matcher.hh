@@ -0,0 +1,43 @@
+//File: guided_matcher.hh
+//Author: Yuxin Wu <ppwwyyxxc@gmail.com>
+
+#pragma once
+#include <vector>
+#include "feature/feature.hh"
+#include "feature/matcher.hh"
+#include "homography.hh"
+#include "match_info.hh"
+
+namespace pano {
+
+// Match features of two images given a transform between them.
+// Each feature of the second image is only compared with the features of the first image
+// around its projection, found in a uniform grid, instead of with the whole image.
+class GuidedMatcher {
+	public:
+		// shape1 is (w, h) of the first image
+		GuidedMatcher(const FeatureSet& feat1, const FeatureSet& feat2,
+				const Shape2D& shape1, float radius);
+
+		GuidedMatcher(const GuidedMatcher&) = delete;
+		GuidedMatcher& operator = (const GuidedMatcher&) = delete;
+
+		// homo: transform from second(f2) -> first(f1)
+		// return pairs of (f1_idx, f2_idx), which pass the ratio test among the candidates
+		MatchData match(const Homography& homo) const;
+
+	protected:
+		const FeatureSet &feat1, &feat2;
+		const Shape2D shape1;
+		float radius;
+
+		// features of the first image in each cell of size radius, row-major
+		int grid_w, grid_h;
+		std::vector<int> cell_start;	// size grid_w * grid_h + 1
+		std::vector<int> cell_feat;
+
+		int cell_x(double x) const;
+		int cell_y(double y) const;
+};
+
+}
@@ -12,17 +12,41 @@ namespace pano {
 		// A transparent reference to a image in file
 		struct ImageRef {
 			std::string fname;
-			Mat32f* img = nullptr;
+			Matuc* img = nullptr;		// the 8-bit image in file
+			Mat32f* fimg = nullptr;	// a modified image, used instead of img if present
 			int _width, _height;
 
 			void load() {
-				if (img) return;
-				img = new Mat32f{read_img(fname.c_str())};
+				if (img || fimg) return;
+				img = new Matuc{read_img_uc(fname.c_str())};
 				_width = img->width();
 				_height = img->height();
 			}
 
-			void release() { if (img) delete img; img = nullptr; }
+			void release() {
+				if (img) delete img;
+				if (fimg) delete fimg;
+				img = nullptr; fimg = nullptr;
+			}
+
+			bool loaded() const { return img || fimg; }
+
+			// the loaded image in float. shares data with the modified image if present
+			Mat32f to_float() const { return fimg ? *fimg : cvt_uc2f(*img); }
+
+			// convert the loaded image to float, to be modified in place
+			Mat32f& make_float() {
+				if (! fimg) {
+					fimg = new Mat32f{cvt_uc2f(*img)};
+					delete img; img = nullptr;
+				}
+				return *fimg;
+			}
+
+			// bilinear interpolation on the loaded image
+			Color interpolate(float r, float c) const {
+				return fimg ? pano::interpolate(*fimg, r, c) : pano::interpolate(*img, r, c);
+			}
 
 			int width() const { return _width; }
 			int height() const { return _height; }
@@ -30,7 +54,7 @@ namespace pano {
 
 			ImageRef(const std::string& fname): fname(fname) {}
 
-			~ImageRef() { if (img) delete img; }
+			~ImageRef() { release(); }
 		};
 
 }
@@ -32,7 +32,7 @@ void MultiBandBlender::create_first_level() {
 		REP(i, range.height()) REP(j, range.width()) {
 			Coor target_coor{j + range.min.x, i + range.min.y};
 			Vec2D orig_coor = img.coor_func(target_coor);
-			Color c = interpolate(*img.imgref.img, orig_coor.y, orig_coor.x);
+			Color c = img.imgref.interpolate(orig_coor.y, orig_coor.x);
 			if (c.get_min() < 0) {	// Color::NO
 				wimg.at(i, j).w = 0;
 				wimg.at(i, j).c = Color::BLACK;	// -1 will mess up with gaussian blur
@@ -9,13 +9,16 @@
 #include <string>
 #include <cmath>
 #include <queue>
+#include <set>
 
 #include "feature/matcher.hh"
+#include "feature/retrieval.hh"
 #include "lib/imgproc.hh"
 #include "lib/timer.hh"
 #include "blender.hh"
 #include "match_info.hh"
 #include "transform_estimate.hh"
+#include "guided_matcher.hh"
 #include "camera_estimator.hh"
 #include "camera.hh"
 #include "warp.hh"
@@ -65,9 +68,11 @@ Mat32f Stitcher::build() {
 
 bool Stitcher::match_image(
 		const PairWiseMatcher& pwmatcher, int i, int j) {
-	auto match = pwmatcher.match(i, j);
-	//auto match = FeatureMatcher(feats[i], feats[j]).match();	// slow
-	TransformEstimation transf(match, keypoints[i], keypoints[j],
+	return match_image(pwmatcher.match(i, j), i, j);
+}
+
+bool Stitcher::match_image(const MatchData& match, int i, int j) {
+	TransformEstimation transf(match, feats[i].coor, feats[j].coor,
 			imgs[i].shape(), imgs[j].shape());	// from j to i
 	MatchInfo info;
 	bool succ = transf.get_transform(&info);
@@ -77,12 +82,30 @@ bool Stitcher::match_image(
 					-(int)info.confidence, i, j);
 		return false;
 	}
+	int nr_match = match.size();
+	if (GUIDED_MATCH) {
+		// the ratio test over the whole image rejects many correct matches.
+		// match again among the features near the projected positions
+		auto shape = imgs[i].shape();
+		float radius = (shape.w + shape.h) * 0.5 / 800 * GUIDED_MATCH_RADIUS;
+		MatchData guided = GuidedMatcher(feats[i], feats[j], shape, radius).match(info.homo);
+		TransformEstimation gtransf(guided, feats[i].coor, feats[j].coor,
+				imgs[i].shape(), imgs[j].shape());
+		MatchInfo ginfo;
+		if (gtransf.refine_transform(info.homo, &ginfo) &&
+				ginfo.match.size() > info.match.size()) {
+			print_debug("Guided matching between image %d and %d: ninliers %lu -> %lu\n",
+					i, j, info.match.size(), ginfo.match.size());
+			info = move(ginfo);
+			nr_match = guided.size();
+		}
+	}
 	auto inv = info.homo.inverse();	// TransformEstimation ensures invertible
 	inv.mult(1.0 / inv[8]);	// TODO more stable?
 	print_debug(
 			"Connection between image %d and %d, ninliers=%lu/%d=%lf, conf=%f\n",
-			i, j, info.match.size(), match.size(),
-			info.match.size() * 1.0 / match.size(),
+			i, j, info.match.size(), nr_match,
+			info.match.size() * 1.0 / nr_match,
 			info.confidence);
 
 	// fill in pairwise matches
@@ -94,12 +117,21 @@ bool Stitcher::match_image(
 }
 
 void Stitcher::pairwise_match() {
+	if (MATCH_GLOBAL_K > 0) {
+		global_match();
+		return;
+	}
 	GuardedTimer tm("pairwise_match()");
 	size_t n = imgs.size();
 	vector<pair<int, int>> tasks;
-	REP(i, n) REPL(j, i + 1, n) tasks.emplace_back(i, j);
-
-	PairWiseMatcher pwmatcher(feats);
+	if (MATCH_TOP_K > 0 && MATCH_TOP_K < (int)n - 1) {
+		tasks = ImageRetrieval(feats).shortlist(MATCH_TOP_K);
+		print_debug("Match %lu of %lu pairs shortlisted by retrieval\n",
+				tasks.size(), n * (n - 1) / 2);
+	} else
+		REP(i, n) REPL(j, i + 1, n) tasks.emplace_back(i, j);
+
+	PairWiseMatcher pwmatcher(feats, index_file());
 #pragma omp parallel for schedule(dynamic)
 	REP(k, (int)tasks.size()) {
 		int i = tasks[k].first, j = tasks[k].second;
@@ -107,10 +139,49 @@ void Stitcher::pairwise_match() {
 	}
 }
 
+void Stitcher::global_match() {
+	GuardedTimer tm("global_match()");
+	int n = imgs.size();
+	auto matches = GlobalMatcher(feats, MATCH_GLOBAL_K).match();
+
+	vector<pair<int, int>> tasks;
+	if (MATCH_TOP_K > 0 && MATCH_TOP_K < n - 1) {
+		// as in Brown & Lowe, only consider the images with the most matches to each image
+		vector<vector<pair<int, int>>> nr_match(n);		// <number of matches, the other image>
+		for (auto& m : matches) {
+			int i = m.first.first, j = m.first.second;
+			nr_match[i].emplace_back(m.second.size(), j);
+			nr_match[j].emplace_back(m.second.size(), i);
+		}
+		set<pair<int, int>> selected;
+		REP(i, n) {
+			auto& v = nr_match[i];
+			int nr_keep = min(MATCH_TOP_K, (int)v.size());
+			partial_sort(v.begin(), v.begin() + nr_keep, v.end(), greater<pair<int, int>>());
+			REP(t, nr_keep)
+				selected.emplace(min(i, v[t].second), max(i, v[t].second));
+		}
+		tasks.assign(selected.begin(), selected.end());
+	} else
+		for (auto& m : matches)
+			tasks.emplace_back(m.first);
+	print_debug("Estimate transforms of %lu of %d pairs\n", tasks.size(), n * (n - 1) / 2);
+
+	// look up the matches before the parallel region, the map must not be modified there
+	vector<const MatchData*> task_matches;
+	for (auto& t : tasks)
+		task_matches.emplace_back(&matches.at(t));
+#pragma omp parallel for schedule(dynamic)
+	REP(k, (int)tasks.size()) {
+		int i = tasks[k].first, j = tasks[k].second;
+		match_image(*task_matches[k], i, j);
+	}
+}
+
 void Stitcher::linear_pairwise_match() {
 	GuardedTimer tm("linear_pairwise_match()");
 	int n = imgs.size();
-	PairWiseMatcher pwmatcher(feats);
+	PairWiseMatcher pwmatcher(feats, index_file());
 #pragma omp parallel for schedule(dynamic)
 	REP(i, n) {
 		int next = (i + 1) % n;
@@ -29,9 +29,13 @@ class Stitcher : public StitcherBase {
 
 		// match two images
 		bool match_image(const PairWiseMatcher&, int i, int j);
+		// estimate the transform of two images from their feature matches
+		bool match_image(const MatchData& match, int i, int j);
 
 		// pairwise matching of all images
 		void pairwise_match();
+		// matching of all images with a global index
+		void global_match();
 		// equivalent to pairwise_match when dealing with linear images
 		void linear_pairwise_match();
 
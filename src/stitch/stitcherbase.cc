@@ -2,33 +2,111 @@
 //Author: Yuxin Wu <ppwwyyxx@gmail.com>
 
 #include "stitcherbase.hh"
+#include "feature_cache.hh"
+#include "lib/bufferpool.hh"
 #include "lib/timer.hh"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+using namespace std;
+
+namespace {
+// float images of the working size held by the detector at a time:
+// the resized input, the gaussian layers of an octave, the DoG and the gradients
+const int DETECT_NR_LAYER = 16;
+}
 
 namespace pano {
 
 void StitcherBase::calc_feature() {
 	GuardedTimer tm("calc_feature()");
 	feats.resize(imgs.size());
-	keypoints.resize(imgs.size());
-	// detect feature
-//#pragma omp parallel for schedule(dynamic)
-	REP(k, imgs.size()) {
-		imgs[k].load();
-		feats[k] = feature_det->detect_feature(*imgs[k].img);
-		if (config::LAZY_READ)
-			imgs[k].release();
+
+	// images whose features are not in the cache
+	vector<int> todo;
+	unique_ptr<FeatureCache> cache;
+	vector<string> entries(imgs.size());
+	if (config::FEATURE_CACHE) {
+		cache.reset(new FeatureCache(config::FEATURE_CACHE_DIR));
+		REP(k, imgs.size()) {
+			entries[k] = cache->entry(imgs[k].fname);
+			Shape2D shape{0, 0};
+			if (cache->load(entries[k], feats[k], shape)) {
+				imgs[k]._width = shape.w;
+				imgs[k]._height = shape.h;
+				print_debug("Image %lu has %d features in cache\n", k, feats[k].size());
+			} else
+				todo.push_back(k);
+		}
+		cache_entries = entries;
+	} else {
+		REP(k, imgs.size())
+			todo.push_back(k);
+	}
+	if (todo.empty()) return;
+
+	const int working_size = feature_det->working_size();
+	// return the number of bytes of the decoded image
+	auto detect = [&](int k) {
+		auto& img = imgs[k];
+		size_t decoded_bytes;
+		if (config::LAZY_READ && ! img.loaded() && working_size) {
+			// the full image is not needed until blending.
+			// JPEG is decoded by libjpeg at a reduced scale close to the working size
+			Mat32f grey = read_img_grey(img.fname.c_str(), working_size, img._width, img._height);
+			decoded_bytes = (size_t)grey.pixels() * sizeof(float);
+			feats[k] = feature_det->detect_feature(grey, img.width(), img.height());
+		} else {
+			img.load();
+			// the image and its float copy
+			decoded_bytes = (size_t)img.width() * img.height() * 3 * (1 + sizeof(float));
+			feats[k] = feature_det->detect_feature(img.to_float());
+			if (config::LAZY_READ)
+				img.release();
+		}
 		if (feats[k].size() == 0)
-			error_exit(ssprintf("Cannot find feature in image %lu!\n", k));
-		print_debug("Image %lu has %lu features\n", k, feats[k].size());
-		keypoints[k].resize(feats[k].size());
-		REP(i, feats[k].size())
-			keypoints[k][i] = feats[k][i].coor;
+			error_exit(ssprintf("Cannot find feature in image %d!\n", k));
+		print_debug("Image %d has %d features\n", k, feats[k].size());
+		if (cache)
+			cache->save(entries[k], feats[k], imgs[k].shape());
+		return decoded_bytes;
+	};
+
+	// Each worker holds the decoded image and the scale space of the detector.
+	// The first image is used to decide how many workers fit in the budget.
+	size_t worker_bytes = detect(todo[0]);
+	{
+		const auto& img = imgs[todo[0]];
+		double area = (double)img.width() * img.height();
+		if (working_size)
+			area *= sqr(working_size * 2.0f / (img.width() + img.height()));
+		worker_bytes += (size_t)(area * DETECT_NR_LAYER * sizeof(float));
 	}
+	int nr_worker = max<size_t>(
+			(size_t)config::FEATURE_MEMORY_BUDGET * 1024 * 1024 / worker_bytes, 1);
+#ifdef _OPENMP
+	update_min(nr_worker, omp_get_max_threads());
+#endif
+	update_min(nr_worker, (int)todo.size() - 1);
+	if (nr_worker > 1)
+		print_debug("Detect features with %d workers\n", nr_worker);
+
+#pragma omp parallel for schedule(dynamic) num_threads(max(nr_worker, 1))
+	REPL(i, 1, (int)todo.size())
+		detect(todo[i]);
+	// the pyramids are not needed any more
+	buffer_pool::trim();
+}
+
+function<string(int)> StitcherBase::index_file() const {
+	if (cache_entries.empty())
+		return nullptr;
+	FeatureCache cache(config::FEATURE_CACHE_DIR);
+	return [this, cache](int k) { return cache.index_entry(cache_entries[k], feats[k]); };
 }
 
 void StitcherBase::free_feature() {
 	feats.clear(); feats.shrink_to_fit();	// free memory for feature
-	keypoints.clear(); keypoints.shrink_to_fit();	// free memory for feature
 }
 
 }
@@ -2,8 +2,10 @@
 //Author: Yuxin Wu <ppwwyyxx@gmail.com>
 
 #pragma once
+#include <functional>
 #include <vector>
 #include <memory>
+#include <string>
 #include "lib/mat.h"
 #include "lib/geometry.hh"
 #include "feature/feature.hh"
@@ -28,16 +30,23 @@ class StitcherBase {
 
 		std::vector<ImageRef> imgs;
 
-		// feature and keypoints of each image
-		std::vector<std::vector<Descriptor>> feats;	// [-w/2,w/2]
-		std::vector<std::vector<Vec2D>> keypoints;	// store coordinates in [-w/2,w/2]
+		// feature of each image, coordinates in [-w/2,w/2]
+		std::vector<FeatureSet> feats;
 
 		// feature detector
 		std::unique_ptr<FeatureDetector> feature_det;
 
+		// entry of each image in the feature cache. empty without the cache
+		std::vector<std::string> cache_entries;
+
 		// get feature descriptor and keypoints for each image
 		void calc_feature();
 
+		// where to save the matching index of image i, next to its cached features.
+		// hashes the descriptors, so only call it when the index is used.
+		// empty without the cache
+		std::function<std::string(int)> index_file() const;
+
 		void free_feature();
 
 	public:
@@ -52,7 +61,7 @@ class StitcherBase {
 				for (auto& n : i)
 					imgs.emplace_back(n);
 
-				feature_det.reset(new SIFTDetector);
+				feature_det = create_feature_detector();
 			}
 
 		StitcherBase(const StitcherBase&) = delete;
@@ -86,6 +86,23 @@ bool TransformEstimation::get_transform(MatchInfo* info) {
 	return fill_inliers_to_matchinfo(inliers, info);
 }
 
+bool TransformEstimation::refine_transform(const Homography& init, MatchInfo* info) {
+	TotalTimer tm("refine_transform");
+	if (match.size() < ESTIMATE_MIN_NR_MATCH)
+		return false;
+	auto inliers = get_inliers(init);
+	if (inliers.size() < ESTIMATE_MIN_NR_MATCH)
+		return false;
+	// one more fit on all inliers, which may include more of the matches
+	auto transform = calc_transform(inliers);
+	if (transform.health()) {
+		auto more = get_inliers(transform);
+		if (more.size() > inliers.size())
+			inliers = move(more);
+	}
+	return fill_inliers_to_matchinfo(inliers, info);
+}
+
 Homography TransformEstimation::calc_transform(const vector<int>& matches) const {
 	vector<Vec2D> p1, p2;
 	for (auto& i : matches) {
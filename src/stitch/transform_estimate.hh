@@ -11,7 +11,6 @@
 namespace pano {
 class MatchData;
 class Homography;
-struct Descriptor;
 
 // find transformation matrix between two set of matched feature
 class TransformEstimation {
@@ -29,6 +28,10 @@ class TransformEstimation {
 		// get a transform matix from second(f2) -> first(f1)
 		bool get_transform(MatchInfo* info);
 
+		// re-estimate the transform from the inliers of a known transform (from f2 to f1),
+		// e.g. on matches found by GuidedMatcher
+		bool refine_transform(const Homography& init, MatchInfo* info);
+
 		enum TransformType { Affine, Homo };
 
 	private: